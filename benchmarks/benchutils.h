@@ -0,0 +1,118 @@
+// Copyright (C) 2017-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <QString>
+#include <QVector>
+#include <QFile>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QCoreApplication>
+#include <QDeadlineTimer>
+#include <QTimer>
+
+#include <algorithm>
+
+#if defined(Q_OS_UNIX)
+#  include <sys/resource.h>
+#endif
+
+
+// Helpers shared by the haiq_bench_* executables. They are header-only, so the benchmarks do not
+// need a library of their own.
+namespace Bench {
+
+// The peak resident set size of this process in bytes, or -1 if it cannot be determined.
+// On Linux the peak can be reset, so that every benchmark case gets its own value: on the
+// other platforms it is the peak since the process started.
+inline qint64 peakMemory()
+{
+#if defined(Q_OS_LINUX)
+    QFile f(u"/proc/self/status"_qs);
+    if (f.open(QIODevice::ReadOnly)) {
+        const QByteArray status = f.readAll();
+        qsizetype pos = status.indexOf("VmHWM:");
+        if (pos >= 0) {
+            pos += 6;
+            const qsizetype eol = status.indexOf('\n', pos);
+            QByteArray value = status.mid(pos, eol - pos).trimmed(); // "1234 kB"
+            value.chop(3);
+            return value.trimmed().toLongLong() * 1024;
+        }
+    }
+    return -1;
+#elif defined(Q_OS_UNIX)
+    struct rusage usage { };
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#  if defined(Q_OS_DARWIN)
+    return qint64(usage.ru_maxrss); // bytes
+#  else
+    return qint64(usage.ru_maxrss) * 1024;
+#  endif
+#else
+    return -1;
+#endif
+}
+
+inline void resetPeakMemory()
+{
+#if defined(Q_OS_LINUX)
+    QFile f(u"/proc/self/clear_refs"_qs);
+    if (f.open(QIODevice::WriteOnly))
+        f.write("5"); // resets VmHWM to the current RSS
+#endif
+}
+
+inline QString formatMemory(qint64 bytes)
+{
+    return (bytes < 0) ? u"n/a"_qs : QString::number(qreal(bytes) / (1024 * 1024), 'f', 1);
+}
+
+// the p-th percentile (0..100) of the samples, using the nearest-rank method
+inline qreal percentile(QVector<qreal> samples, int p)
+{
+    if (samples.isEmpty())
+        return 0;
+    std::sort(samples.begin(), samples.end());
+    const qsizetype rank = std::max<qsizetype>(1, (samples.size() * p + 99) / 100);
+    return samples.at(std::min(rank, samples.size()) - 1);
+}
+
+inline qreal median(const QVector<qreal> &samples)
+{
+    return percentile(samples, 50);
+}
+
+// runs f iterations times and returns the duration of each run in ms
+template <typename F>
+QVector<qreal> measure(int iterations, F &&f)
+{
+    QVector<qreal> samples;
+    samples.reserve(iterations);
+    for (int i = 0; i < iterations; ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        f();
+        samples << qreal(timer.nsecsElapsed()) / 1000000;
+    }
+    return samples;
+}
+
+// spins the event loop until cond() is true, returns false on a timeout
+template <typename F>
+bool waitUntil(F &&cond, int timeoutMSecs = 30000)
+{
+    const QDeadlineTimer deadline(timeoutMSecs);
+    QTimer heartbeat; // makes sure processEvents() returns, even if nothing else happens
+    heartbeat.start(100);
+    while (!cond()) {
+        if (deadline.hasExpired())
+            return false;
+        QCoreApplication::processEvents(QEventLoop::AllEvents | QEventLoop::WaitForMoreEvents);
+    }
+    return true;
+}
+
+} // namespace Bench
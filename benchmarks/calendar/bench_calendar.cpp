@@ -0,0 +1,249 @@
+// Copyright (C) 2017-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QTextStream>
+
+#include "calendar/calendar.h"
+#include "calendar/icalendarparser.h"
+#include "benchutils.h"
+#include "icsgenerator.h"
+
+
+// Runs the calendar pipeline on one feed, stage by stage. This is a friend of Calendar, so the
+// stages can be timed separately without any instrumentation in the production code.
+class CalendarBenchmark
+{
+public:
+    struct Result
+    {
+        qsizetype m_size = 0; // bytes
+        qsizetype m_components = 0;
+        qsizetype m_entries = 0;
+        qreal m_parseMs = 0;    // ICalendarParser on the whole feed, single-threaded
+        qreal m_expandMs = 0;   // parseComponent() minus the plain parse of the same blocks
+        qreal m_coldMs = 0;     // parseNetworkReply() without a component cache
+        qreal m_warmMs = 0;     // parseNetworkReply() on an unchanged re-fetch
+        qreal m_modelMs = 0;    // updateEntries() into an empty model
+        qreal m_refreshMs = 0;  // updateEntries() with 1% removed and 1% changed entries
+        int m_refreshSignals = 0; // rowsRemoved/rowsInserted/dataChanged of that refresh
+        qint64 m_peakMemory = -1;
+    };
+
+    static Result run(const QByteArray &data, int iterations);
+
+private:
+    static QVector<QByteArray> splitComponents(const QByteArray &data);
+};
+
+QVector<QByteArray> CalendarBenchmark::splitComponents(const QByteArray &data)
+{
+    QVector<QByteArray> components;
+    qsizetype pos = 0;
+    qsizetype blockStart = -1;
+    QByteArrayView blockEndLine;
+
+    while (pos < data.size()) {
+        qsizetype eol = data.indexOf('\n', pos);
+        if (eol < 0)
+            eol = data.size();
+        const QByteArrayView line = QByteArrayView(data).sliced(pos, eol - pos).trimmed();
+
+        if ((blockStart < 0) && (line == "BEGIN:VEVENT")) {
+            blockStart = pos;
+            blockEndLine = "END:VEVENT";
+        } else if ((blockStart < 0) && (line == "BEGIN:VTODO")) {
+            blockStart = pos;
+            blockEndLine = "END:VTODO";
+        } else if ((blockStart >= 0) && (line == blockEndLine)) {
+            components << data.mid(blockStart, qMin(eol + 1, data.size()) - blockStart);
+            blockStart = -1;
+        }
+        pos = eol + 1;
+    }
+    return components;
+}
+
+CalendarBenchmark::Result CalendarBenchmark::run(const QByteArray &data, int iterations)
+{
+    Result r;
+    r.m_size = data.size();
+
+    Bench::resetPeakMemory();
+
+    auto parse = [](const QByteArray &icsData) {
+        ICalendarParser p(icsData);
+        try {
+            p.parse();
+        } catch (const std::exception &e) {
+            qWarning().noquote() << "iCalendar parse error:" << e.what();
+        }
+    };
+
+    r.m_parseMs = Bench::median(Bench::measure(iterations, [&]() { parse(data); }));
+
+    const QVector<QByteArray> components = splitComponents(data);
+    r.m_components = components.size();
+
+    const qreal blockParseMs = Bench::median(Bench::measure(iterations, [&]() {
+        for (const auto &component : components)
+            parse(component);
+    }));
+    const qreal blockExpandMs = Bench::median(Bench::measure(iterations, [&]() {
+        for (const auto &component : components)
+            Calendar::parseComponent(0, component);
+    }));
+    r.m_expandMs = qMax<qreal>(0, blockExpandMs - blockParseMs);
+
+    Calendar::ParseResult result;
+    r.m_coldMs = Bench::median(Bench::measure(iterations, [&]() {
+        result = Calendar::parseNetworkReply(0, data, { });
+    }));
+    r.m_entries = result.m_entries.size();
+
+    r.m_warmMs = Bench::median(Bench::measure(iterations, [&]() {
+        Calendar::parseNetworkReply(0, data, result.m_components);
+    }));
+
+    // a refresh with some removed and some changed entries: the keys stay sorted
+    QVector<Calendar::Entry> refreshed;
+    refreshed.reserve(result.m_entries.size());
+    for (qsizetype i = 0; i < result.m_entries.size(); ++i) {
+        if ((i % 100) == 0)
+            continue;
+        refreshed << result.m_entries.at(i);
+        if ((i % 100) == 50)
+            refreshed.last().m_summary += u" (changed)"_qs;
+    }
+
+    QVector<qreal> modelSamples;
+    QVector<qreal> refreshSamples;
+    for (int i = 0; i < iterations; ++i) {
+        // the panels always have an UpcomingCalendarEntries proxy filtering the model
+        Calendar calendar(QList<Calendar::SourceConfiguration> { });
+        UpcomingCalendarEntries upcoming;
+        upcoming.setCalendar(&calendar);
+        upcoming.setFrom(QDateTime(QDate(1970, 1, 1), QTime(0, 0)));
+        upcoming.setTo(QDateTime(QDate(2100, 1, 1), QTime(0, 0)));
+
+        modelSamples << Bench::measure(1, [&]() { calendar.updateEntries(0, result.m_entries); });
+
+        int signalCount = 0;
+        auto count = [&signalCount]() { ++signalCount; };
+        QObject::connect(&calendar, &QAbstractItemModel::rowsRemoved, count);
+        QObject::connect(&calendar, &QAbstractItemModel::rowsInserted, count);
+        QObject::connect(&calendar, &QAbstractItemModel::dataChanged, count);
+
+        refreshSamples << Bench::measure(1, [&]() { calendar.updateEntries(0, refreshed); });
+        r.m_refreshSignals = signalCount;
+    }
+    r.m_modelMs = Bench::median(modelSamples);
+    r.m_refreshMs = Bench::median(refreshSamples);
+
+    r.m_peakMemory = Bench::peakMemory();
+    return r;
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser clp;
+    clp.setApplicationDescription(u"Benchmarks the HAiQ calendar pipeline: parsing, recurrence "
+                                  "expansion and model updates, on a synthetic feed and on the "
+                                  "fixture corpus."_qs);
+    clp.addHelpOption();
+    clp.addOptions({
+        { u"events"_qs, u"Number of events in the synthetic feed (0 to skip it)."_qs, u"n"_qs, u"5000"_qs },
+        { u"recurring"_qs, u"Share of recurring series in the synthetic feed."_qs, u"share"_qs, u"0.2"_qs },
+        { u"exdates"_qs, u"EXDATEs per EXDATE-heavy series."_qs, u"n"_qs, u"40"_qs },
+        { u"windows-tz"_qs, u"Share of events with Windows TZIDs."_qs, u"share"_qs, u"0.3"_qs },
+        { u"no-fold"_qs, u"Do not fold long lines in the synthetic feed."_qs },
+        { u"seed"_qs, u"Seed of the synthetic feed."_qs, u"n"_qs, u"42"_qs },
+        { u"iterations"_qs, u"Runs per stage: the median is reported."_qs, u"n"_qs, u"5"_qs },
+        { u"fixtures"_qs, u"Directory with the *.ics fixtures (empty to skip them)."_qs, u"dir"_qs,
+          QString::fromLocal8Bit(HAIQ_BENCH_FIXTURES_DIR) },
+        { u"dump"_qs, u"Write the synthetic feed to this file and exit."_qs, u"file"_qs },
+        { u"verbose"_qs, u"Do not suppress the calendar's log output."_qs },
+    });
+    clp.addPositionalArgument(u"files"_qs, u"Additional .ics files to benchmark."_qs, u"[files...]"_qs);
+    clp.process(app);
+
+    if (!clp.isSet(u"verbose"_qs))
+        QLoggingCategory::setFilterRules(u"default.debug=false\ndefault.warning=false"_qs);
+
+    IcsGenerator::Options options;
+    options.m_events = clp.value(u"events"_qs).toInt();
+    options.m_recurringShare = clp.value(u"recurring"_qs).toDouble();
+    options.m_exdatesPerSeries = clp.value(u"exdates"_qs).toInt();
+    options.m_windowsTzShare = clp.value(u"windows-tz"_qs).toDouble();
+    options.m_foldLines = !clp.isSet(u"no-fold"_qs);
+    options.m_seed = clp.value(u"seed"_qs).toUInt();
+    const int iterations = qMax(1, clp.value(u"iterations"_qs).toInt());
+
+    QTextStream out(stdout);
+
+    if (clp.isSet(u"dump"_qs)) {
+        QFile f(clp.value(u"dump"_qs));
+        if (!f.open(QIODevice::WriteOnly)) {
+            out << "Cannot write " << f.fileName() << ": " << f.errorString() << Qt::endl;
+            return 1;
+        }
+        f.write(IcsGenerator::generate(options));
+        return 0;
+    }
+
+    QList<std::pair<QString, QByteArray>> feeds;
+    if (options.m_events > 0)
+        feeds.append({ u"synthetic-%1"_qs.arg(options.m_events), IcsGenerator::generate(options) });
+
+    QStringList files;
+    if (const QString fixtures = clp.value(u"fixtures"_qs); !fixtures.isEmpty()) {
+        const QDir dir(fixtures);
+        const auto entries = dir.entryInfoList({ u"*.ics"_qs }, QDir::Files, QDir::Name);
+        for (const auto &fi : entries)
+            files << fi.absoluteFilePath();
+    }
+    files << clp.positionalArguments();
+
+    for (const auto &fileName : std::as_const(files)) {
+        QFile f(fileName);
+        if (!f.open(QIODevice::ReadOnly)) {
+            out << "Cannot read " << fileName << ": " << f.errorString() << Qt::endl;
+            return 1;
+        }
+        feeds.append({ QFileInfo(fileName).completeBaseName(), f.readAll() });
+    }
+
+    out << "iterations: " << iterations << " (median), peak memory: "
+#if defined(Q_OS_LINUX)
+        << "per feed"
+#else
+        << "since start"
+#endif
+        << Qt::endl << Qt::endl;
+
+    out << qSetFieldWidth(18) << Qt::left << "feed" << qSetFieldWidth(10) << Qt::right
+        << "KB" << "compon." << "entries" << "MB/s" << "parse ms" << "expand ms" << "cold ms"
+        << "warm ms" << "model ms" << "refr. ms" << "signals" << "peak MB"
+        << qSetFieldWidth(0) << Qt::endl;
+
+    for (const auto &[name, data] : std::as_const(feeds)) {
+        const auto r = CalendarBenchmark::run(data, iterations);
+        const qreal mbPerSec = r.m_parseMs ? (qreal(r.m_size) / (1024 * 1024)) / (r.m_parseMs / 1000) : 0;
+
+        out << qSetFieldWidth(18) << Qt::left << name << qSetFieldWidth(10) << Qt::right
+            << qSetRealNumberPrecision(1) << Qt::fixed
+            << qreal(r.m_size) / 1024 << r.m_components << r.m_entries << mbPerSec
+            << qSetRealNumberPrecision(2) << r.m_parseMs << r.m_expandMs << r.m_coldMs << r.m_warmMs
+            << r.m_modelMs << r.m_refreshMs << r.m_refreshSignals << Bench::formatMemory(r.m_peakMemory)
+            << qSetFieldWidth(0) << Qt::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,298 @@
+// Copyright (C) 2017-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <QByteArrayList>
+#include <QDate>
+#include <QDateTime>
+#include <QRandomGenerator>
+#include <QTime>
+#include <QTimeZone>
+
+#include "icsgenerator.h"
+
+
+namespace {
+
+// Google and Nextcloud use IANA ids, Exchange uses Windows ids: all of them come with
+// VTIMEZONE definitions. The IANA zones come first.
+struct Zone
+{
+    const char *m_tzId;
+    const char *m_definition;
+};
+
+const Zone zones[] = {
+    { "Europe/Berlin",
+      "BEGIN:VTIMEZONE\r\n"
+      "TZID:Europe/Berlin\r\n"
+      "X-LIC-LOCATION:Europe/Berlin\r\n"
+      "BEGIN:DAYLIGHT\r\n"
+      "TZOFFSETFROM:+0100\r\n"
+      "TZOFFSETTO:+0200\r\n"
+      "TZNAME:CEST\r\n"
+      "DTSTART:19700329T020000\r\n"
+      "RRULE:FREQ=YEARLY;BYMONTH=3;BYDAY=-1SU\r\n"
+      "END:DAYLIGHT\r\n"
+      "BEGIN:STANDARD\r\n"
+      "TZOFFSETFROM:+0200\r\n"
+      "TZOFFSETTO:+0100\r\n"
+      "TZNAME:CET\r\n"
+      "DTSTART:19701025T030000\r\n"
+      "RRULE:FREQ=YEARLY;BYMONTH=10;BYDAY=-1SU\r\n"
+      "END:STANDARD\r\n"
+      "END:VTIMEZONE\r\n" },
+    { "America/New_York",
+      "BEGIN:VTIMEZONE\r\n"
+      "TZID:America/New_York\r\n"
+      "X-LIC-LOCATION:America/New_York\r\n"
+      "BEGIN:DAYLIGHT\r\n"
+      "TZOFFSETFROM:-0500\r\n"
+      "TZOFFSETTO:-0400\r\n"
+      "TZNAME:EDT\r\n"
+      "DTSTART:19700308T020000\r\n"
+      "RRULE:FREQ=YEARLY;BYMONTH=3;BYDAY=2SU\r\n"
+      "END:DAYLIGHT\r\n"
+      "BEGIN:STANDARD\r\n"
+      "TZOFFSETFROM:-0400\r\n"
+      "TZOFFSETTO:-0500\r\n"
+      "TZNAME:EST\r\n"
+      "DTSTART:19701101T020000\r\n"
+      "RRULE:FREQ=YEARLY;BYMONTH=11;BYDAY=1SU\r\n"
+      "END:STANDARD\r\n"
+      "END:VTIMEZONE\r\n" },
+    { "W. Europe Standard Time",
+      "BEGIN:VTIMEZONE\r\n"
+      "TZID:W. Europe Standard Time\r\n"
+      "BEGIN:STANDARD\r\n"
+      "DTSTART:16010101T030000\r\n"
+      "TZOFFSETFROM:+0200\r\n"
+      "TZOFFSETTO:+0100\r\n"
+      "RRULE:FREQ=YEARLY;INTERVAL=1;BYDAY=-1SU;BYMONTH=10\r\n"
+      "END:STANDARD\r\n"
+      "BEGIN:DAYLIGHT\r\n"
+      "DTSTART:16010101T020000\r\n"
+      "TZOFFSETFROM:+0100\r\n"
+      "TZOFFSETTO:+0200\r\n"
+      "RRULE:FREQ=YEARLY;INTERVAL=1;BYDAY=-1SU;BYMONTH=3\r\n"
+      "END:DAYLIGHT\r\n"
+      "END:VTIMEZONE\r\n" },
+    { "Pacific Standard Time",
+      "BEGIN:VTIMEZONE\r\n"
+      "TZID:Pacific Standard Time\r\n"
+      "BEGIN:STANDARD\r\n"
+      "DTSTART:16010101T020000\r\n"
+      "TZOFFSETFROM:-0700\r\n"
+      "TZOFFSETTO:-0800\r\n"
+      "RRULE:FREQ=YEARLY;INTERVAL=1;BYDAY=1SU;BYMONTH=11\r\n"
+      "END:STANDARD\r\n"
+      "BEGIN:DAYLIGHT\r\n"
+      "DTSTART:16010101T020000\r\n"
+      "TZOFFSETFROM:-0800\r\n"
+      "TZOFFSETTO:-0700\r\n"
+      "RRULE:FREQ=YEARLY;INTERVAL=1;BYDAY=2SU;BYMONTH=3\r\n"
+      "END:DAYLIGHT\r\n"
+      "END:VTIMEZONE\r\n" },
+};
+constexpr int ianaZoneCount = 2;
+constexpr int windowsZoneCount = 2;
+
+const char * const words[] = {
+    "Team", "Meeting", "Review", "Standup", "Planning", "Sprint", "Retro", "Lunch", "Dentist",
+    "Yoga", "Besprechung", "Büro", "Kita", "Elternabend", "Müll", "Budget", "Q3", "Release",
+    "Call", "Workshop", "Training", "Fußball", "Geburtstag", "Urlaub", "Kundentermin",
+};
+constexpr int wordCount = int(sizeof(words) / sizeof(words[0]));
+
+class Writer
+{
+public:
+    explicit Writer(bool foldLines)
+        : m_foldLines(foldLines)
+    { }
+
+    // a content line, folded at 75 octets (without splitting UTF-8 sequences)
+    void line(const QByteArray &l)
+    {
+        if (!m_foldLines || (l.size() <= 75)) {
+            m_data += l;
+            m_data += "\r\n";
+            return;
+        }
+        qsizetype pos = 0;
+        qsizetype max = 75;
+        while (pos < l.size()) {
+            qsizetype len = qMin(max, l.size() - pos);
+            while ((pos + len < l.size()) && ((quint8(l.at(pos + len)) & 0xc0) == 0x80))
+                --len;
+            if (pos)
+                m_data += ' ';
+            m_data += QByteArrayView(l).sliced(pos, len);
+            m_data += "\r\n";
+            pos += len;
+            max = 74; // the leading space counts
+        }
+    }
+
+    void raw(const char *block) { m_data += block; }
+
+    QByteArray m_data;
+
+private:
+    bool m_foldLines;
+};
+
+QByteArray dateTime(const QDateTime &dt)
+{
+    return dt.toString(u"yyyyMMdd'T'HHmmss"_qs).toLatin1();
+}
+
+QByteArray date(const QDate &d)
+{
+    return d.toString(u"yyyyMMdd"_qs).toLatin1();
+}
+
+} // namespace
+
+
+QByteArray IcsGenerator::generate(const Options &options)
+{
+    QRandomGenerator rng(options.m_seed);
+    auto chance = [&rng](qreal share) { return rng.generateDouble() < share; };
+
+    Writer w(options.m_foldLines);
+    w.m_data.reserve(qsizetype(options.m_events) * 700);
+
+    w.line("BEGIN:VCALENDAR");
+    w.line("PRODID:-//HAiQ//Benchmark Generator//EN");
+    w.line("VERSION:2.0");
+    w.line("CALSCALE:GREGORIAN");
+    w.line("METHOD:PUBLISH");
+    w.line("X-WR-CALNAME:Synthetic");
+    for (const auto &zone : zones)
+        w.raw(zone.m_definition);
+
+    // UTC: only the wall-clock time is written, so the local time zone must not shift anything
+    const QDateTime base(QDate(2024, 1, 1), QTime(0, 0), QTimeZone::UTC);
+    const QByteArray stamp = "DTSTAMP:20240101T000000Z";
+
+    for (int i = 0; i < options.m_events; ++i) {
+        const bool windowsTz = chance(options.m_windowsTzShare);
+        const Zone &zone = zones[windowsTz ? ianaZoneCount + int(rng.bounded(windowsZoneCount))
+                                           : int(rng.bounded(ianaZoneCount))];
+        const QByteArray tzId = zone.m_tzId;
+        const bool allDay = chance(options.m_allDayShare);
+        const bool recurring = chance(options.m_recurringShare);
+
+        // two years around the base date, on quarter hours during the day
+        const QDateTime start = base.addDays(qint64(rng.bounded(730)) - 365)
+                .addSecs(qint64(7 * 4 + rng.bounded(13 * 4)) * 15 * 60);
+        const QDateTime end = start.addSecs(qint64(1 + rng.bounded(8)) * 15 * 60);
+
+        const QByteArray uid = QByteArray::number(rng.generate64(), 16) + "@haiq-bench";
+
+        QByteArray summary;
+        for (int n = 0, count = 1 + int(rng.bounded(4)); n < count; ++n)
+            summary += QByteArray(n ? " " : "") + words[rng.bounded(wordCount)];
+
+        auto writeStartEnd = [&](const QDateTime &s, const QDateTime &e) {
+            if (allDay) {
+                w.line("DTSTART;VALUE=DATE:" + date(s.date()));
+                w.line("DTEND;VALUE=DATE:" + date(s.date().addDays(1)));
+            } else {
+                w.line("DTSTART;TZID=" + tzId + ':' + dateTime(s));
+                w.line("DTEND;TZID=" + tzId + ':' + dateTime(e));
+            }
+        };
+        auto writeCommon = [&]() {
+            w.line(stamp);
+            w.line("UID:" + uid);
+            w.line("CREATED:20230601T120000Z");
+            w.line("LAST-MODIFIED:20231215T080000Z");
+            w.line("SUMMARY:" + summary);
+            // long, escaped descriptions are what makes real-world feeds big (and folded)
+            QByteArray description = "DESCRIPTION:";
+            for (int n = 0, count = int(rng.bounded(40)); n < count; ++n) {
+                description += words[rng.bounded(wordCount)];
+                description += ((n % 9) == 8) ? "\\n" : ((n % 5) == 4) ? "\\, " : " ";
+            }
+            w.line(description);
+            w.line("LOCATION:Room " + QByteArray::number(rng.bounded(500)) + "\\, Building "
+                   + QByteArray(1, char('A' + rng.bounded(6))));
+            w.line("SEQUENCE:0");
+            w.line("STATUS:CONFIRMED");
+            w.line("TRANSP:OPAQUE");
+            if (windowsTz) {
+                w.line("X-MICROSOFT-CDO-BUSYSTATUS:BUSY");
+                w.line("X-MICROSOFT-CDO-IMPORTANCE:1");
+            }
+            if (chance(options.m_alarmShare)) {
+                w.line("BEGIN:VALARM");
+                w.line("ACTION:DISPLAY");
+                w.line("DESCRIPTION:This is an event reminder");
+                w.line("TRIGGER:-PT" + QByteArray::number(5 * (1 + rng.bounded(6))) + 'M');
+                w.line("END:VALARM");
+            }
+        };
+
+        w.line("BEGIN:VEVENT");
+        writeStartEnd(start, end);
+
+        int intervalDays = 0;
+        if (recurring) {
+            const bool exdateHeavy = chance(options.m_exdateHeavyShare);
+            switch (exdateHeavy ? 1 : rng.bounded(4)) {
+            case 0:
+                intervalDays = 1;
+                w.line("RRULE:FREQ=DAILY;UNTIL=" + dateTime(start.addDays(60)) + 'Z');
+                break;
+            case 1:
+                intervalDays = 7;
+                w.line("RRULE:FREQ=WEEKLY;COUNT=" + QByteArray::number(exdateHeavy ? 150 : 52));
+                break;
+            case 2:
+                intervalDays = 14;
+                w.line("RRULE:FREQ=WEEKLY;INTERVAL=2;UNTIL=" + dateTime(start.addYears(1)) + 'Z');
+                break;
+            default:
+                w.line("RRULE:FREQ=MONTHLY;COUNT=24");
+                break;
+            }
+
+            if (exdateHeavy && intervalDays) {
+                QByteArrayList exdates;
+                for (int n = 0; n < options.m_exdatesPerSeries; ++n) {
+                    const QDateTime exdate = start.addDays(qint64(intervalDays) * (1 + n * 3));
+                    exdates << (allDay ? date(exdate.date()) : dateTime(exdate));
+                }
+                const QByteArray prefix = allDay ? QByteArray("EXDATE;VALUE=DATE:")
+                                                 : QByteArray("EXDATE;TZID=" + tzId + ':');
+                if (windowsTz) {
+                    // Exchange: one comma separated list
+                    w.line(prefix + exdates.join(','));
+                } else {
+                    // Google: one line per exception
+                    for (const auto &exdate : std::as_const(exdates))
+                        w.line(prefix + exdate);
+                }
+            }
+        }
+        writeCommon();
+        w.line("END:VEVENT");
+
+        if (recurring && intervalDays && chance(options.m_overrideShare)) {
+            // a moved occurrence: same UID, RECURRENCE-ID of the original start
+            const QDateTime original = start.addDays(qint64(intervalDays) * 2);
+            w.line("BEGIN:VEVENT");
+            writeStartEnd(original.addSecs(60 * 60), end.addDays(qint64(intervalDays) * 2).addSecs(60 * 60));
+            if (allDay)
+                w.line("RECURRENCE-ID;VALUE=DATE:" + date(original.date()));
+            else
+                w.line("RECURRENCE-ID;TZID=" + tzId + ':' + dateTime(original));
+            writeCommon();
+            w.line("END:VEVENT");
+        }
+    }
+
+    w.line("END:VCALENDAR");
+    return w.m_data;
+}
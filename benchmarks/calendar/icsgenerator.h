@@ -0,0 +1,30 @@
+// Copyright (C) 2017-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <QByteArray>
+#include <QtGlobal>
+
+
+// Generates a deterministic, synthetic iCalendar feed: the same options always result in the
+// same bytes, so runs on different machines or revisions can be compared directly.
+class IcsGenerator
+{
+public:
+    struct Options
+    {
+        int m_events = 5000;
+        qreal m_recurringShare = 0.2;    // of all events: RRULE series
+        qreal m_exdateHeavyShare = 0.25; // of the series: with m_exdatesPerSeries EXDATEs
+        int m_exdatesPerSeries = 40;
+        qreal m_overrideShare = 0.1;     // of the series: with a RECURRENCE-ID override
+        qreal m_windowsTzShare = 0.3;    // of all events: Exchange style Windows TZIDs
+        qreal m_allDayShare = 0.1;
+        qreal m_alarmShare = 0.3;
+        bool m_foldLines = true;         // at 75 octets, as RFC 5545 requires
+        quint32 m_seed = 42;
+    };
+
+    static QByteArray generate(const Options &options);
+};
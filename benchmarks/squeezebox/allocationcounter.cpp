@@ -0,0 +1,79 @@
+// Copyright (C) 2017-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cstdlib>
+
+#include "allocationcounter.h"
+
+
+// Plain thread_locals without constructors: these do not need any allocation themselves,
+// which would recurse into malloc() below.
+static thread_local bool t_counting = false;
+static thread_local quint64 t_allocations = 0;
+
+#if defined(__GLIBC__)
+
+// glibc explicitly supports replacing these four, see "Replacing malloc" in its manual. The
+// libc implementations stay reachable under their __libc_ names.
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+void *malloc(size_t size) noexcept
+{
+    if (t_counting)
+        ++t_allocations;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept
+{
+    if (t_counting)
+        ++t_allocations;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept
+{
+    // growing a buffer in place is cheap, but it is still a trip into the allocator
+    if (t_counting)
+        ++t_allocations;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) noexcept
+{
+    __libc_free(ptr);
+}
+
+} // extern "C"
+
+#endif
+
+namespace AllocationCounter {
+
+bool isSupported()
+{
+#if defined(__GLIBC__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+void start()
+{
+    t_allocations = 0;
+    t_counting = true;
+}
+
+quint64 stop()
+{
+    t_counting = false;
+    return t_allocations;
+}
+
+} // namespace AllocationCounter
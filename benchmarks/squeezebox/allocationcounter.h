@@ -0,0 +1,19 @@
+// Copyright (C) 2017-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <QtGlobal>
+
+
+// Counts the heap allocations of the calling thread. Qt's containers allocate with malloc()
+// directly, so counting operator new would miss most of them: instead malloc() and friends are
+// replaced for the whole executable, which is only supported on glibc.
+namespace AllocationCounter {
+
+bool isSupported();
+
+void start();  // for the calling thread only
+quint64 stop(); // returns the number of allocations since start()
+
+} // namespace AllocationCounter
@@ -0,0 +1,345 @@
+// Copyright (C) 2017-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QLoggingCategory>
+#include <QStandardPaths>
+#include <QTextStream>
+#include <QThread>
+#include <QUrl>
+
+#include <algorithm>
+#include <numeric>
+
+#include "squeezebox/squeezeboxserver.h"
+#include "benchutils.h"
+#include "allocationcounter.h"
+#include "mocklmsserver.h"
+
+
+// Runs SqueezeBoxServer against the mock server. The application creates its single instance
+// via createInstance(), but here every connect is measured on a fresh instance from create().
+class SqueezeBoxBenchmark
+{
+public:
+    SqueezeBoxBenchmark(MockLmsServer *mock, quint16 port, const MockLmsServer::Options &options);
+
+    static void removeCache();
+
+    // the time from the creation of the client until all players are completely set up
+    SqueezeBoxServer *createClient(int windowSize, qreal &readyMs);
+    void destroyClient(SqueezeBoxServer *server);
+
+    // the round-trip time of every command in ms: one at a time, or all at once
+    QVector<qreal> sequential(SqueezeBoxServer *server, int commands);
+    QVector<qreal> burst(SqueezeBoxServer *server, int commands, qreal &totalMs);
+
+    struct Storm
+    {
+        qsizetype m_bytes = 0;
+        qreal m_ms = 0;
+        quint64 m_allocations = 0;
+    };
+    Storm storm(SqueezeBoxServer *server, int lines, int run);
+
+private:
+    bool isReady(const SqueezeBoxServer *server) const;
+
+    MockLmsServer *m_mock;
+    quint16 m_port;
+    MockLmsServer::Options m_options;
+};
+
+SqueezeBoxBenchmark::SqueezeBoxBenchmark(MockLmsServer *mock, quint16 port, const MockLmsServer::Options &options)
+    : m_mock(mock)
+    , m_port(port)
+    , m_options(options)
+{ }
+
+void SqueezeBoxBenchmark::removeCache()
+{
+    QFile::remove(SqueezeBoxServer::cacheFileName());
+}
+
+bool SqueezeBoxBenchmark::isReady(const SqueezeBoxServer *server) const
+{
+    const auto players = server->players();
+    if (players.size() != m_options.m_players)
+        return false;
+
+    return std::all_of(players.cbegin(), players.cend(), [this](const SqueezeBoxPlayer *player) {
+        return !player->mode().isEmpty()
+                && player->alarmsEnabled()
+                && (player->alarms().size() == m_options.m_alarmsPerPlayer)
+                && (player->playlist()->rowCount() == m_options.m_playlistTracks);
+    });
+}
+
+SqueezeBoxServer *SqueezeBoxBenchmark::createClient(int windowSize, qreal &readyMs)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    auto *server = SqueezeBoxServer::create(u"127.0.0.1"_qs, m_port);
+    server->setCommandWindowSize(windowSize);
+
+    if (!Bench::waitUntil([&]() { return isReady(server); }))
+        qFatal("Timed out waiting for the SqueezeBox players to be set up");
+
+    readyMs = qreal(timer.nsecsElapsed()) / 1000000;
+    return server;
+}
+
+void SqueezeBoxBenchmark::destroyClient(SqueezeBoxServer *server)
+{
+    // the sockets have to be unconnected before the server is deleted, otherwise their
+    // destructors would call back into it
+    server->disconnectFromServer();
+    delete server;
+}
+
+QVector<qreal> SqueezeBoxBenchmark::sequential(SqueezeBoxServer *server, int commands)
+{
+    QVector<qreal> samples;
+    samples.reserve(commands);
+
+    for (int i = 0; i < commands; ++i) {
+        bool replied = false;
+        QElapsedTimer timer;
+        timer.start();
+        server->command({ u"version"_qs, u"?"_qs }, [&replied](const QStringList &) { replied = true; });
+
+        if (!Bench::waitUntil([&]() { return replied; }))
+            qFatal("Timed out waiting for a command reply");
+        samples << qreal(timer.nsecsElapsed()) / 1000000;
+    }
+    return samples;
+}
+
+QVector<qreal> SqueezeBoxBenchmark::burst(SqueezeBoxServer *server, int commands, qreal &totalMs)
+{
+    QVector<qreal> samples(commands);
+    int replies = 0;
+    QElapsedTimer clock;
+    clock.start();
+
+    for (int i = 0; i < commands; ++i) {
+        const qint64 sentAt = clock.nsecsElapsed();
+        server->command({ u"version"_qs, u"?"_qs }, [&samples, &replies, &clock, i, sentAt](const QStringList &) {
+            samples[i] = qreal(clock.nsecsElapsed() - sentAt) / 1000000;
+            ++replies;
+        });
+    }
+    // with a window of 1, a burst takes at least commands times the server's reply delay
+    if (!Bench::waitUntil([&]() { return replies == commands; }, 30000 + commands * 100))
+        qFatal("Timed out waiting for the command replies");
+
+    totalMs = qreal(clock.nsecsElapsed()) / 1000000;
+    return samples;
+}
+
+SqueezeBoxBenchmark::Storm SqueezeBoxBenchmark::storm(SqueezeBoxServer *server, int lines, int run)
+{
+    const QString sentinel = u"sentinel %1"_qs.arg(run);
+    const auto players = server->players();
+    const auto it = std::find_if(players.cbegin(), players.cend(), [](const SqueezeBoxPlayer *p) {
+        return p->playerId() == MockLmsServer::playerId(0);
+    });
+    Q_ASSERT(it != players.cend());
+    const SqueezeBoxPlayer *player = *it;
+
+    Storm result;
+    QMetaObject::invokeMethod(m_mock, [this, lines, &sentinel]() {
+        return m_mock->prepareStorm(lines, QUrl::toPercentEncoding(sentinel));
+    }, Qt::BlockingQueuedConnection, &result.m_bytes);
+
+    QElapsedTimer timer;
+    AllocationCounter::start();
+    timer.start();
+
+    QMetaObject::invokeMethod(m_mock, &MockLmsServer::sendStorm, Qt::QueuedConnection);
+    const bool done = Bench::waitUntil([&]() { return player->title() == sentinel; });
+
+    result.m_ms = qreal(timer.nsecsElapsed()) / 1000000;
+    result.m_allocations = AllocationCounter::stop();
+    if (!done)
+        qFatal("Timed out waiting for the end of the notification storm");
+    return result;
+}
+
+
+static QVector<int> parseIntList(const QString &s)
+{
+    QVector<int> result;
+    const auto sl = s.split(u',', Qt::SkipEmptyParts);
+    for (const auto &str : sl)
+        result << str.trimmed().toInt();
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName(u"haiq_bench_squeezebox"_qs);
+
+    QCommandLineParser clp;
+    clp.setApplicationDescription(u"Benchmarks the HAiQ SqueezeBox client against a scripted, local "
+                                  "Logitech Media Server CLI: connect-to-ready time, command "
+                                  "round-trips and notification throughput."_qs);
+    clp.addHelpOption();
+    clp.addOptions({
+        { u"players"_qs, u"Number of players on the mock server."_qs, u"n"_qs, u"4"_qs },
+        { u"alarms"_qs, u"Alarms per player."_qs, u"n"_qs, u"3"_qs },
+        { u"tracks"_qs, u"Playlist entries per player."_qs, u"n"_qs, u"50"_qs },
+        { u"delays"_qs, u"Comma separated reply delays of the mock server in ms."_qs, u"list"_qs, u"0,5"_qs },
+        { u"windows"_qs, u"Comma separated command window sizes."_qs, u"list"_qs, u"1,4,8,16"_qs },
+        { u"commands"_qs, u"Commands per round-trip run."_qs, u"n"_qs, u"500"_qs },
+        { u"storm"_qs, u"Notifications per storm (0 to skip it)."_qs, u"n"_qs, u"20000"_qs },
+        { u"iterations"_qs, u"Runs per connect and storm: the median is reported."_qs, u"n"_qs, u"5"_qs },
+        { u"verbose"_qs, u"Do not suppress the client's log output."_qs },
+    });
+    clp.process(app);
+
+    if (!clp.isSet(u"verbose"_qs))
+        QLoggingCategory::setFilterRules(u"default.debug=false\ndefault.warning=false"_qs);
+
+    // the client's player cache must not touch the real one
+    QStandardPaths::setTestModeEnabled(true);
+
+    MockLmsServer::Options options;
+    options.m_players = qMax(1, clp.value(u"players"_qs).toInt());
+    options.m_alarmsPerPlayer = qMax(0, clp.value(u"alarms"_qs).toInt());
+    options.m_playlistTracks = qMax(0, clp.value(u"tracks"_qs).toInt());
+    const QVector<int> delays = parseIntList(clp.value(u"delays"_qs));
+    const QVector<int> windows = parseIntList(clp.value(u"windows"_qs));
+    const int commands = qMax(1, clp.value(u"commands"_qs).toInt());
+    const int stormLines = qMax(0, clp.value(u"storm"_qs).toInt());
+    const int iterations = qMax(1, clp.value(u"iterations"_qs).toInt());
+
+    QTextStream out(stdout);
+
+    QThread mockThread;
+    mockThread.setObjectName(u"MockLmsServer"_qs);
+    auto *mock = new MockLmsServer(options);
+    mock->moveToThread(&mockThread);
+    QObject::connect(&mockThread, &QThread::finished, mock, &QObject::deleteLater);
+    mockThread.start();
+
+    quint16 port = 0;
+    QMetaObject::invokeMethod(mock, &MockLmsServer::listen, Qt::BlockingQueuedConnection, &port);
+    if (!port) {
+        out << "Cannot start the mock server" << Qt::endl;
+        mockThread.quit();
+        mockThread.wait();
+        return 1;
+    }
+
+    auto setReplyDelay = [mock](int msecs) {
+        QMetaObject::invokeMethod(mock, [mock, msecs]() { mock->setReplyDelay(msecs); },
+                                  Qt::BlockingQueuedConnection);
+    };
+
+    SqueezeBoxBenchmark bench(mock, port, options);
+
+    out << "players: " << options.m_players << ", alarms per player: " << options.m_alarmsPerPlayer
+        << ", playlist entries: " << options.m_playlistTracks << ", iterations: " << iterations
+        << " (median)" << Qt::endl << Qt::endl;
+
+    out << qSetFieldWidth(10) << Qt::right << "delay ms" << "cold ms" << "cached ms"
+        << qSetFieldWidth(0) << "    connect-to-ready, without and with the player cache" << Qt::endl;
+
+    struct RoundTrips
+    {
+        int m_delay;
+        QString m_window; // "seq" for one command at a time
+        QVector<qreal> m_samples;
+        qreal m_perSecond;
+    };
+    QList<RoundTrips> roundTrips;
+
+    for (const int delay : delays) {
+        setReplyDelay(delay);
+
+        QVector<qreal> cold;
+        QVector<qreal> cached;
+        qreal readyMs = 0;
+        for (int i = 0; i < iterations; ++i) {
+            SqueezeBoxBenchmark::removeCache();
+            bench.destroyClient(bench.createClient(8, readyMs));
+            cold << readyMs;
+        }
+        for (int i = 0; i < iterations; ++i) {
+            bench.destroyClient(bench.createClient(8, readyMs));
+            cached << readyMs;
+        }
+        out << qSetFieldWidth(10) << Qt::right << qSetRealNumberPrecision(2) << Qt::fixed
+            << delay << Bench::median(cold) << Bench::median(cached) << qSetFieldWidth(0) << Qt::endl;
+
+        // the round-trips are measured on one connection per delay
+        SqueezeBoxServer *server = bench.createClient(8, readyMs);
+
+        const auto samples = bench.sequential(server, commands);
+        const qreal totalMs = std::accumulate(samples.cbegin(), samples.cend(), qreal(0));
+        roundTrips.append({ delay, u"seq"_qs, samples, totalMs ? (commands * 1000 / totalMs) : 0 });
+
+        for (const int window : windows) {
+            server->setCommandWindowSize(window);
+            qreal burstMs = 0;
+            const auto burstSamples = bench.burst(server, commands, burstMs);
+            roundTrips.append({ delay, QString::number(window), burstSamples,
+                                burstMs ? (commands * 1000 / burstMs) : 0 });
+        }
+        bench.destroyClient(server);
+    }
+
+    out << Qt::endl << qSetFieldWidth(10) << Qt::right << "delay ms" << "window" << "p50 ms"
+        << "p90 ms" << "p99 ms" << "max ms" << "cmds/s" << qSetFieldWidth(0)
+        << "    " << commands << " round-trips: one at a time (seq), or all at once" << Qt::endl;
+
+    for (const auto &rt : std::as_const(roundTrips)) {
+        out << qSetFieldWidth(10) << Qt::right << qSetRealNumberPrecision(2) << Qt::fixed
+            << rt.m_delay << rt.m_window << Bench::percentile(rt.m_samples, 50)
+            << Bench::percentile(rt.m_samples, 90) << Bench::percentile(rt.m_samples, 99)
+            << Bench::percentile(rt.m_samples, 100) << qSetRealNumberPrecision(0) << rt.m_perSecond
+            << qSetFieldWidth(0) << Qt::endl;
+    }
+
+    if (stormLines > 0) {
+        setReplyDelay(0);
+        qreal readyMs = 0;
+        SqueezeBoxServer *server = bench.createClient(8, readyMs);
+
+        QVector<qreal> ms;
+        QVector<qreal> allocations;
+        qsizetype bytes = 0;
+        for (int i = 0; i < iterations; ++i) {
+            const auto storm = bench.storm(server, stormLines, i);
+            bytes = storm.m_bytes;
+            ms << storm.m_ms;
+            allocations << qreal(storm.m_allocations) / stormLines;
+        }
+        bench.destroyClient(server);
+
+        const qreal medianMs = Bench::median(ms);
+        out << Qt::endl << qSetFieldWidth(10) << Qt::right << "lines" << "KB" << "ms" << "lines/s"
+            << "MB/s" << "allocs" << qSetFieldWidth(0)
+            << "    notification storm: 50% our players' status, 35% other players, 10% alarms, "
+               "5% other; allocations per line" << Qt::endl;
+        out << qSetFieldWidth(10) << Qt::right << qSetRealNumberPrecision(2) << Qt::fixed
+            << stormLines << qreal(bytes) / 1024 << medianMs
+            << qSetRealNumberPrecision(0) << (medianMs ? (stormLines * 1000 / medianMs) : 0)
+            << qSetRealNumberPrecision(2) << (medianMs ? ((qreal(bytes) / (1024 * 1024)) / (medianMs / 1000)) : 0);
+        if (AllocationCounter::isSupported())
+            out << Bench::median(allocations);
+        else
+            out << "n/a";
+        out << qSetFieldWidth(0) << Qt::endl;
+    }
+
+    mockThread.quit();
+    mockThread.wait();
+    return 0;
+}
@@ -0,0 +1,254 @@
+// Copyright (C) 2017-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <QTcpSocket>
+#include <QTimer>
+#include <QUrl>
+
+#include "mocklmsserver.h"
+
+
+MockLmsServer::MockLmsServer(const Options &options, QObject *parent)
+    : QObject(parent)
+    , m_options(options)
+    , m_server(this)
+{
+    for (int i = 0; i < m_options.m_players; ++i)
+        m_rawPlayerIds << QUrl::toPercentEncoding(playerId(i));
+    m_clock.start();
+
+    connect(&m_server, &QTcpServer::newConnection, this, &MockLmsServer::onNewConnection);
+}
+
+quint16 MockLmsServer::listen()
+{
+    if (!m_server.listen(QHostAddress::LocalHost))
+        return 0;
+    return m_server.serverPort();
+}
+
+void MockLmsServer::setReplyDelay(int msecs)
+{
+    m_replyDelay = qMax(0, msecs);
+}
+
+QString MockLmsServer::playerId(int index)
+{
+    // MAC addresses, like the ones of real players
+    return u"00:04:20:00:%1:%2"_qs.arg(index / 256, 2, 16, u'0').arg(index % 256, 2, 16, u'0');
+}
+
+QByteArray MockLmsServer::alarmId(int player, int alarm) const
+{
+    return QByteArray::number((player + 1) * 0x100 + alarm, 16).rightJustified(8, '0');
+}
+
+void MockLmsServer::onNewConnection()
+{
+    while (auto *socket = m_server.nextPendingConnection()) {
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+
+        Connection &c = m_connections[socket];
+        c.m_delayTimer = new QTimer(socket);
+        c.m_delayTimer->setSingleShot(true);
+        c.m_delayTimer->setTimerType(Qt::PreciseTimer);
+        c.m_delayTimer->callOnTimeout(this, [this, socket]() { flushDelayed(socket); });
+
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { onReadyRead(socket); });
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+            m_connections.remove(socket);
+            socket->deleteLater();
+        });
+    }
+}
+
+void MockLmsServer::onReadyRead(QTcpSocket *socket)
+{
+    auto it = m_connections.find(socket);
+    if (it == m_connections.end())
+        return;
+    Connection &c = *it;
+    c.m_buffer.append(socket->readAll());
+
+    // all the replies to one batch of pipelined commands go out together
+    QByteArray out;
+    qsizetype pos = 0;
+    qsizetype eol;
+    while ((eol = c.m_buffer.indexOf('\n', pos)) >= 0) {
+        const QByteArray line = c.m_buffer.sliced(pos, eol - pos).trimmed();
+        pos = eol + 1;
+        if (line.isEmpty())
+            continue;
+
+        const QByteArray reply = handleLine(c, line);
+        if (!reply.isEmpty()) {
+            out.append(reply);
+            out.append('\n');
+        }
+    }
+    c.m_buffer.remove(0, pos);
+
+    if (out.isEmpty())
+        return;
+
+    if ((m_replyDelay <= 0) && c.m_delayed.isEmpty()) {
+        socket->write(out);
+    } else {
+        c.m_delayed.enqueue({ m_clock.elapsed() + m_replyDelay, out });
+        if (!c.m_delayTimer->isActive())
+            c.m_delayTimer->start(m_replyDelay);
+    }
+}
+
+void MockLmsServer::flushDelayed(QTcpSocket *socket)
+{
+    auto it = m_connections.find(socket);
+    if (it == m_connections.end())
+        return;
+
+    const qint64 now = m_clock.elapsed();
+    QByteArray out;
+    while (!it->m_delayed.isEmpty() && (it->m_delayed.head().first <= now))
+        out.append(it->m_delayed.dequeue().second);
+    if (!out.isEmpty())
+        socket->write(out);
+    if (!it->m_delayed.isEmpty())
+        it->m_delayTimer->start(int(it->m_delayed.head().first - now));
+}
+
+QByteArray MockLmsServer::handleLine(Connection &c, const QByteArray &line)
+{
+    if ((line == "listen") || line.startsWith("listen ")) {
+        c.m_isListen = true;
+        return "listen";
+    }
+
+    const QByteArrayList args = line.split(' ');
+    const int player = int(m_rawPlayerIds.indexOf(args.constFirst()));
+    const QByteArray cmd = args.value((player >= 0) ? 1 : 0);
+
+    if (args.constLast() == "%3F") {
+        // a query: the reply is the command, with the ? replaced by the value
+        QByteArray value = "0";
+        if (line == "pref httpport %3F")
+            value = "9000";
+        else if (line == "version %3F")
+            value = "8.5.2";
+        else if ((player >= 0) && (cmd == "playerpref") && (args.value(2) == "alarmsEnabled"))
+            value = "1";
+        return line.chopped(3) + value;
+    }
+
+    if (cmd == "players") {
+        QByteArray reply = line + " count%3A" + QByteArray::number(m_options.m_players);
+        for (int i = 0; i < m_options.m_players; ++i) {
+            // 192.0.2.0/24 is reserved for documentation, so it never matches a local address
+            reply += " playerindex%3A" + QByteArray::number(i) + " playerid%3A" + m_rawPlayerIds.at(i)
+                    + " uuid%3A" + QByteArray::number(0x7e57c0de + i, 16).repeated(4)
+                    + " ip%3A192.0.2." + QByteArray::number(10 + i) + "%3A" + QByteArray::number(41000 + i)
+                    + " name%3A" + QUrl::toPercentEncoding(u"Player %1"_qs.arg(i + 1))
+                    + " seq_no%3A0 model%3Asqueezelite modelname%3ASqueezeLite power%3A1 isplaying%3A1"
+                      " displaytype%3Anone isplayer%3A1 canpoweroff%3A1 connected%3A1 firmware%3Av1.9.9-1432";
+        }
+        return reply;
+    }
+
+    if ((player >= 0) && (cmd == "alarms")) {
+        QByteArray reply = line + " fade%3A1 count%3A" + QByteArray::number(m_options.m_alarmsPerPlayer);
+        for (int i = 0; i < m_options.m_alarmsPerPlayer; ++i) {
+            reply += " id%3A" + alarmId(player, i) + " dow%3A1%2C2%2C3%2C4%2C5 enabled%3A1 repeat%3A1"
+                    " time%3A" + QByteArray::number(6 * 3600 + i * 1800)
+                    + " volume%3A50 shufflemode%3A0 url%3ACURRENT_PLAYLIST";
+        }
+        return reply;
+    }
+
+    if ((player >= 0) && (cmd == "status")) {
+        // the now-playing subscription on the listen connection only has the current track
+        if (args.contains("subscribe%3A0"))
+            return line + statusTags(player, 0) + " playlist%20index%3A3" + trackTags(3);
+
+        QByteArray reply = line + statusTags(player, 0);
+        for (int i = 0; i < m_options.m_playlistTracks; ++i)
+            reply += " playlist%20index%3A" + QByteArray::number(i) + trackTags(i);
+        return reply;
+    }
+
+    // everything else, e.g. "mixer volume 40", is just echoed, like the real server does
+    return line;
+}
+
+QByteArray MockLmsServer::statusTags(int player, qreal time) const
+{
+    // the playlist timestamp never changes, so the client does not re-fetch the playlist
+    return " player_name%3A" + QUrl::toPercentEncoding(u"Player %1"_qs.arg(player + 1))
+            + " player_connected%3A1 player_ip%3A192.0.2." + QByteArray::number(10 + player)
+            + "%3A" + QByteArray::number(41000 + player)
+            + " power%3A1 signalstrength%3A0 mode%3Aplay time%3A" + QByteArray::number(time, 'f', 3)
+            + " rate%3A1 duration%3A245.640 can_seek%3A1 mixer%20volume%3A35 playlist%20repeat%3A0"
+              " playlist%20shuffle%3A0 playlist%20mode%3Aoff seq_no%3A0 playlist_cur_index%3A3"
+              " playlist_timestamp%3A1713369481.23456 playlist_tracks%3A"
+            + QByteArray::number(m_options.m_playlistTracks);
+}
+
+QByteArray MockLmsServer::trackTags(int track, const QByteArray &title) const
+{
+    const QByteArray rawTitle = title.isEmpty() ? QUrl::toPercentEncoding(u"Track %1 – Olé"_qs.arg(track + 1))
+                                                : title;
+    return " id%3A" + QByteArray::number(10000 + track) + " title%3A" + rawTitle
+            + " artist%3A" + QUrl::toPercentEncoding(u"Artist %1"_qs.arg(track % 7 + 1))
+            + " coverid%3A" + QByteArray::number(0x5f3a0000 + track, 16)
+            + " duration%3A" + QByteArray::number(180 + (track % 5) * 31.5, 'f', 3)
+            + " album%3A" + QUrl::toPercentEncoding(u"Album %1"_qs.arg(track % 5 + 1));
+}
+
+qsizetype MockLmsServer::prepareStorm(int lines, const QByteArray &sentinel)
+{
+    static const QByteArray subscription = " status - 1 subscribe%3A0 tags%3AacdlK";
+    static const QByteArray otherPlayer = "00%3A04%3A20%3Aff%3A00%3A";
+
+    m_storm.clear();
+    m_storm.reserve(qsizetype(lines) * 640);
+
+    for (int i = 0; i < (lines - 1); ++i) {
+        const int slot = i % 20;
+        const int player = (i / 20) % m_options.m_players;
+        const QByteArray &id = m_rawPlayerIds.at(player);
+
+        if (slot < 10) {
+            // 50%: status updates of our players
+            m_storm += id + subscription + statusTags(player, i * 0.1) + " playlist%20index%3A3"
+                    + trackTags(3) + '\n';
+        } else if (slot < 17) {
+            // 35%: the traffic of other players, which the client has to drop
+            const QByteArray other = otherPlayer + QByteArray::number(slot, 16).rightJustified(2, '0');
+            if (slot < 14) {
+                m_storm += other + subscription + statusTags(player, i * 0.1) + " playlist%20index%3A3"
+                        + trackTags(3) + '\n';
+            } else if (slot < 16) {
+                m_storm += other + " playlist newsong " + QUrl::toPercentEncoding(u"Track %1"_qs.arg(i))
+                        + " 3\n";
+            } else {
+                m_storm += other + " mixer volume 40\n";
+            }
+        } else if ((slot < 19) && (m_options.m_alarmsPerPlayer > 0)) {
+            // 10%: alarm updates of our players
+            m_storm += id + " alarm update id%3A" + alarmId(player, i % m_options.m_alarmsPerPlayer)
+                    + " time%3A" + QByteArray::number(6 * 3600 + (i % 3600)) + '\n';
+        } else {
+            // 5%: other notifications of our players
+            m_storm += id + " mixer volume 35\n";
+        }
+    }
+    m_storm += m_rawPlayerIds.constFirst() + subscription + statusTags(0, 0) + " playlist%20index%3A3"
+            + trackTags(3, sentinel) + '\n';
+    return m_storm.size();
+}
+
+void MockLmsServer::sendStorm()
+{
+    for (auto it = m_connections.cbegin(); it != m_connections.cend(); ++it) {
+        if (it->m_isListen)
+            it.key()->write(m_storm);
+    }
+}
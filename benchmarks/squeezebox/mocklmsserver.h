@@ -0,0 +1,73 @@
+// Copyright (C) 2017-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <QObject>
+#include <QTcpServer>
+#include <QHash>
+#include <QQueue>
+#include <QElapsedTimer>
+
+QT_FORWARD_DECLARE_CLASS(QTcpSocket)
+QT_FORWARD_DECLARE_CLASS(QTimer)
+
+
+// A scripted Logitech Media Server CLI. It answers the queries SqueezeBoxServer sends while
+// connecting with a fixed set of players, alarms and playlist entries, echoes every other
+// command and can flood the listen connections with notifications.
+// It is meant to be moved to a thread of its own, so its work is not measured with the client's.
+class MockLmsServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Options
+    {
+        int m_players = 4;
+        int m_alarmsPerPlayer = 3;
+        int m_playlistTracks = 50;
+    };
+
+    explicit MockLmsServer(const Options &options, QObject *parent = nullptr);
+
+    quint16 listen(); // on localhost, returns the port or 0 on failure
+
+    // every reply is held back for msecs, in order, to simulate a remote or busy server
+    void setReplyDelay(int msecs);
+
+    // Prepares a storm of notifications and returns its size in bytes. The mix is roughly what
+    // a server with a few active players sends: status updates of our players, the traffic of
+    // other players, alarm updates and other notifications. The last line is a status update of
+    // player 0 with the (encoded) title sentinel, so the client can tell when it is done.
+    qsizetype prepareStorm(int lines, const QByteArray &sentinel);
+    void sendStorm(); // on all listen connections
+
+    static QString playerId(int index);
+
+private:
+    struct Connection
+    {
+        QByteArray m_buffer;
+        bool m_isListen = false;
+        QQueue<std::pair<qint64, QByteArray>> m_delayed; // due on m_clock, reply line(s)
+        QTimer *m_delayTimer = nullptr;
+    };
+
+    void onNewConnection();
+    void onReadyRead(QTcpSocket *socket);
+    void flushDelayed(QTcpSocket *socket);
+    QByteArray handleLine(Connection &c, const QByteArray &line);
+
+    QByteArray statusTags(int player, qreal time) const;
+    QByteArray trackTags(int track, const QByteArray &title = { }) const;
+    QByteArray alarmId(int player, int alarm) const;
+
+    Options m_options;
+    QTcpServer m_server;
+    QHash<QTcpSocket *, Connection> m_connections;
+    QByteArrayList m_rawPlayerIds; // percent-encoded
+    int m_replyDelay = 0;
+    QElapsedTimer m_clock;
+    QByteArray m_storm;
+};
@@ -4,10 +4,20 @@
 #include <QNetworkAccessManager>
 #include <QNetworkRequest>
 #include <QNetworkReply>
+#include <QTimer>
+#include <QSaveFile>
+#include <QFile>
+#include <QDir>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
 #include <QDebug>
 #include <qqml.h>
 #include <QtConcurrent/QtConcurrent>
 
+#include <numeric>
+
 #include "calendar.h"
 #include "exception.h"
 #include "icalendarparser.h"
@@ -19,7 +29,9 @@ enum Role {
     Summary,
     Duration,
     AllDay,
-    SameDay
+    SameDay,
+    Color,
+    Todo
 };
 
 Calendar *Calendar::s_instance = nullptr;
@@ -29,63 +41,99 @@ Calendar *Calendar::instance()
     return s_instance;
 }
 
-Calendar *Calendar::createInstance(const QUrl &url, QObject *parent)
+Calendar *Calendar::createInstance(const QList<SourceConfiguration> &sources, QObject *parent)
 {
     if (Q_UNLIKELY(s_instance))
         qFatal("Calendar::createInstance() was called a second time.");
 
-    s_instance = new Calendar(url, parent);
+    s_instance = new Calendar(sources, parent);
     return s_instance;
 }
 
-Calendar::Calendar(const QUrl &url, QObject *parent)
+Calendar::Calendar(const QList<SourceConfiguration> &sources, QObject *parent)
     : QAbstractListModel(parent)
-    , m_url(url)
     , m_nam(new QNetworkAccessManager(this))
+    , m_reminderTimer(new QTimer(this))
+    , m_remindersFiredUntil(QDateTime::currentSecsSinceEpoch())
 {
-    m_disabled = m_url.isEmpty() || !m_url.isValid();
-    if (m_disabled)
-        qWarning() << "Calendar is disabled due to missing configuration";
+    m_reminderTimer->setSingleShot(true);
+    m_reminderTimer->setTimerType(Qt::PreciseTimer);
+    m_reminderTimer->callOnTimeout(this, &Calendar::fireReminders);
+
+    for (const auto &config : sources) {
+        if (config.m_url.isEmpty() || !config.m_url.isValid()) {
+            qWarning() << "Calendar: ignoring source with invalid URL"
+                       << config.m_url.toDisplayString(QUrl::RemoveUserInfo);
+            continue;
+        }
 
-    connect(m_nam, &QNetworkAccessManager::finished, this, &Calendar::handleNetworkReply);
+        auto *source = new Source;
+        source->m_index = int(m_sources.size());
+        source->m_config = config;
+        m_sources << source;
+
+        connect(&source->m_parserWatcher, &QFutureWatcher<ParseResult>::finished, this, [this, source]() {
+            ParseResult result = source->m_parserWatcher.result();
+            source->m_componentCache = result.m_components;
+            updateEntries(source->m_index, result.m_entries);
+            saveCache(source);
+            finishLoading(source);
+        });
+
+        // this is called before the QML UI is loaded, so we can show the cached data right away
+        loadCache(source);
+
+        source->m_refreshTimer = new QTimer(this);
+        source->m_refreshTimer->setSingleShot(true);
+        source->m_refreshTimer->callOnTimeout(this, [this, source]() { load(source, false); });
+        scheduleRefresh(source);
+    }
 
-    connect(&m_parserWatcher, &QFutureWatcher<QVector<Entry>>::finished, this, [this]() {
-        m_entries = m_parserWatcher.result();
-        endResetModel();
-        m_isLoading = false;
-        emit isLoadingChanged(m_isLoading);
-    });
+    m_disabled = m_sources.isEmpty();
+    if (m_disabled)
+        qWarning() << "Calendar is disabled due to missing configuration";
 
     connect(this, &QAbstractItemModel::modelReset, this, &Calendar::countChanged);
     connect(this, &QAbstractItemModel::rowsInserted, this, &Calendar::countChanged);
     connect(this, &QAbstractItemModel::rowsRemoved, this, &Calendar::countChanged);
 }
 
+Calendar::~Calendar()
+{
+    for (auto *source : std::as_const(m_sources))
+        source->m_parserWatcher.waitForFinished();
+    qDeleteAll(m_sources);
+}
+
 int Calendar::rowCount(const QModelIndex &parent) const
 {
-    return parent.isValid() ? 0 : int(m_entries.size());
+    return parent.isValid() ? 0 : int(m_store.size());
 }
 
 QVariant Calendar::data(const QModelIndex &index, int role) const
 {
-    if (index.parent().isValid() || !index.isValid() || index.row() < 0 || index.row() >= m_entries.size())
+    if (index.parent().isValid() || !index.isValid() || index.row() < 0 || index.row() >= m_store.size())
         return QVariant();
 
-    const Entry &entry = m_entries.at(index.row());
+    const int row = index.row();
 
     switch (role) {
     case StartDateTime:
-        return entry.m_start;
+        return m_store.startDateTime(row);
     case EndDateTime:
-        return entry.m_end;
+        return m_store.endDateTime(row);
     case Summary:
-        return entry.m_summary;
+        return m_store.summary(row);
     case Duration:
-        return entry.m_duration;
+        return m_store.m_end.at(row) - m_store.m_start.at(row);
     case AllDay:
-        return entry.m_allDay;
+        return bool(m_store.m_flags.at(row) & AllDayFlag);
     case SameDay:
-        return entry.m_sameDay;
+        return bool(m_store.m_flags.at(row) & SameDayFlag);
+    case Color:
+        return m_sources.at(m_store.m_source.at(row))->m_config.m_color;
+    case Todo:
+        return bool(m_store.m_flags.at(row) & TodoFlag);
     }
     return QVariant();
 }
@@ -98,11 +146,24 @@ QHash<int, QByteArray> Calendar::roleNames() const
         { Summary, "summary" },
         { Duration, "duration" },
         { AllDay, "allDay" },
-        { SameDay, "sameDay" }
+        { SameDay, "sameDay" },
+        { Color, "color" },
+        { Todo, "todo" }
     };
     return roleNames;
 }
 
+void Calendar::updateLoading()
+{
+    bool loading = std::any_of(m_sources.cbegin(), m_sources.cend(), [](const Source *source) {
+        return source->m_isLoading;
+    });
+    if (loading != m_isLoading) {
+        m_isLoading = loading;
+        emit isLoadingChanged(m_isLoading);
+    }
+}
+
 bool Calendar::isLoading() const
 {
     return m_isLoading;
@@ -113,9 +174,9 @@ int Calendar::count() const
     return rowCount();
 }
 
-void Calendar::reload()
+void Calendar::reload(bool force)
 {
-    load();
+    load(force);
 }
 
 QVariantMap Calendar::get(int row) const
@@ -130,27 +191,775 @@ QVariantMap Calendar::get(int row) const
 }
 
 
-void Calendar::load()
+bool Calendar::Entry::keyLessThan(const Entry &e1, const Entry &e2)
+{
+    if (e1.m_source != e2.m_source)
+        return e1.m_source < e2.m_source;
+    if (int c = e1.m_uid.compare(e2.m_uid))
+        return c < 0;
+    return e1.m_recurrenceId < e2.m_recurrenceId;
+}
+
+void Calendar::EntryStore::insert(qsizetype row, const QVector<Entry> &entries, qsizetype first,
+                                  qsizetype count)
+{
+    // open one gap per array for the whole run: inserting the entries one by one would move
+    // the tail of all the arrays for every single entry
+    m_source.insert(row, count, 0);
+    m_uid.insert(row, count, 0);
+    m_recurrenceId.insert(row, count, 0);
+    m_summary.insert(row, count, 0);
+    m_start.insert(row, count, 0);
+    m_end.insert(row, count, 0);
+    m_zone.insert(row, count, 0);
+    m_flags.insert(row, count, 0);
+    m_alarms.insert(row, count, { });
+
+    for (qsizetype n = 0; n < count; ++n)
+        replace(row + n, entries.at(first + n));
+}
+
+void Calendar::EntryStore::replace(qsizetype row, const Entry &entry)
+{
+    m_source[row] = entry.m_source;
+    m_uid[row] = intern(entry.m_uid);
+    m_recurrenceId[row] = entry.m_recurrenceId;
+    m_summary[row] = intern(entry.m_summary);
+    m_start[row] = entry.m_start;
+    m_end[row] = entry.m_end;
+    m_zone[row] = zoneIndex(entry.m_timeZone);
+    m_flags[row] = entry.m_flags;
+    m_alarms[row] = entry.m_alarms;
+}
+
+void Calendar::EntryStore::remove(qsizetype row, qsizetype count)
 {
-    if (m_isLoading || m_disabled)
+    m_source.remove(row, count);
+    m_uid.remove(row, count);
+    m_recurrenceId.remove(row, count);
+    m_summary.remove(row, count);
+    m_start.remove(row, count);
+    m_end.remove(row, count);
+    m_zone.remove(row, count);
+    m_flags.remove(row, count);
+    m_alarms.remove(row, count);
+}
+
+void Calendar::EntryStore::compact()
+{
+    // interned strings are never released on removal, so we have to garbage collect them from
+    // time to time
+    if (m_strings.size() < 2 * (m_uid.size() + m_summary.size()) + 256)
         return;
 
-    QNetworkRequest request(m_url);
+    QVector<int> remap(m_strings.size(), -1);
+    QStringList strings;
+    QHash<QString, int> stringIndex;
+
+    auto remapAll = [&](QVector<int> &indexes) {
+        for (int &i : indexes) {
+            if (remap.at(i) < 0) {
+                remap[i] = int(strings.size());
+                stringIndex.insert(m_strings.at(i), remap.at(i));
+                strings.append(m_strings.at(i));
+            }
+            i = remap.at(i);
+        }
+    };
+    remapAll(m_uid);
+    remapAll(m_summary);
+
+    m_strings = strings;
+    m_stringIndex = stringIndex;
+}
+
+int Calendar::EntryStore::intern(const QString &s)
+{
+    auto it = m_stringIndex.constFind(s);
+    if (it != m_stringIndex.cend())
+        return *it;
+
+    int i = int(m_strings.size());
+    m_strings.append(s);
+    m_stringIndex.insert(s, i);
+    return i;
+}
+
+quint16 Calendar::EntryStore::zoneIndex(const QTimeZone &tz)
+{
+    // there are only a handful of different zones in any calendar
+    auto i = m_zones.indexOf(tz);
+    if (i < 0) {
+        i = m_zones.size();
+        m_zones.append(tz);
+    }
+    return quint16(i);
+}
+
+bool Calendar::EntryStore::keyLessThan(qsizetype row, const Entry &entry) const
+{
+    if (m_source.at(row) != entry.m_source)
+        return m_source.at(row) < entry.m_source;
+    if (int c = m_strings.at(m_uid.at(row)).compare(entry.m_uid))
+        return c < 0;
+    return m_recurrenceId.at(row) < entry.m_recurrenceId;
+}
+
+bool Calendar::EntryStore::keyLessThan(const Entry &entry, qsizetype row) const
+{
+    if (entry.m_source != m_source.at(row))
+        return entry.m_source < m_source.at(row);
+    if (int c = entry.m_uid.compare(m_strings.at(m_uid.at(row))))
+        return c < 0;
+    return entry.m_recurrenceId < m_recurrenceId.at(row);
+}
+
+bool Calendar::EntryStore::equals(qsizetype row, const Entry &entry) const
+{
+    return (m_source.at(row) == entry.m_source)
+            && (m_recurrenceId.at(row) == entry.m_recurrenceId)
+            && (m_start.at(row) == entry.m_start)
+            && (m_end.at(row) == entry.m_end)
+            && (m_flags.at(row) == entry.m_flags)
+            && (m_zones.at(m_zone.at(row)) == entry.m_timeZone)
+            && (m_alarms.at(row) == entry.m_alarms)
+            && (m_strings.at(m_uid.at(row)) == entry.m_uid)
+            && (m_strings.at(m_summary.at(row)) == entry.m_summary);
+}
+
+QDateTime Calendar::EntryStore::startDateTime(qsizetype row) const
+{
+    return QDateTime::fromSecsSinceEpoch(m_start.at(row), m_zones.at(m_zone.at(row)));
+}
+
+QDateTime Calendar::EntryStore::endDateTime(qsizetype row) const
+{
+    return QDateTime::fromSecsSinceEpoch(m_end.at(row), m_zones.at(m_zone.at(row)));
+}
+
+void Calendar::updateEntries(int source, const QVector<Entry> &newEntries)
+{
+    // Both m_store and newEntries are sorted by key, so we can walk them in lockstep and only
+    // report the minimal set of removed, inserted and changed ranges to the views. The old data
+    // stays visible until this point.
+    // The source index is the primary sort key, so we only have to look at the source's range
+    // and the entries of all the other sources stay untouched.
+
+    const auto &sources = m_store.m_source;
+    qsizetype row = std::lower_bound(sources.cbegin(), sources.cend(), source) - sources.cbegin();
+    qsizetype end = std::lower_bound(sources.cbegin() + row, sources.cend(), source + 1) - sources.cbegin();
+    qsizetype i = 0;
+
+    auto isRemoved = [&](qsizetype r) {
+        return (r < end)
+                && ((i >= newEntries.size()) || m_store.keyLessThan(r, newEntries.at(i)));
+    };
+    auto isInserted = [&](qsizetype n) {
+        return (n < newEntries.size())
+                && ((row >= end) || m_store.keyLessThan(newEntries.at(n), row));
+    };
+
+    while ((row < end) || (i < newEntries.size())) {
+        if (isRemoved(row)) {
+            qsizetype last = row;
+            while (isRemoved(last + 1))
+                ++last;
+
+            beginRemoveRows({ }, int(row), int(last));
+            for (qsizetype r = row; r <= last; ++r)
+                updateSearchIndex(r, -1);
+            m_store.remove(row, last - row + 1);
+            end -= (last - row + 1);
+            endRemoveRows();
+        } else if (isInserted(i)) {
+            qsizetype last = i;
+            while (isInserted(last + 1))
+                ++last;
+
+            const qsizetype count = last - i + 1;
+            beginInsertRows({ }, int(row), int(row + count - 1));
+            m_store.insert(row, newEntries, i, count);
+            for (qsizetype n = 0; n < count; ++n)
+                updateSearchIndex(row++, +1);
+            end += count;
+            endInsertRows();
+            i = last + 1;
+        } else {
+            // same key: check for changed data
+            qsizetype first = -1;
+            while ((row < end) && (i < newEntries.size())
+                   && !m_store.keyLessThan(row, newEntries.at(i))
+                   && !m_store.keyLessThan(newEntries.at(i), row)) {
+                if (!m_store.equals(row, newEntries.at(i))) {
+                    const bool summaryChanged = (m_store.summary(row) != newEntries.at(i).m_summary);
+                    if (summaryChanged)
+                        updateSearchIndex(row, -1);
+                    m_store.replace(row, newEntries.at(i));
+                    if (summaryChanged)
+                        updateSearchIndex(row, +1);
+                    if (first < 0)
+                        first = row;
+                } else if (first >= 0) {
+                    emit dataChanged(index(int(first)), index(int(row - 1)));
+                    first = -1;
+                }
+                ++row;
+                ++i;
+            }
+            if (first >= 0)
+                emit dataChanged(index(int(first)), index(int(row - 1)));
+        }
+    }
+    m_store.compact();
+    m_intervalIndex.m_dirty = true;
+    updateReminders();
+    emit entriesUpdated();
+}
+
+QStringList Calendar::searchTokens(const QString &text)
+{
+    // lower-case words of at least 2 letters or digits
+    QStringList tokens;
+    qsizetype start = -1;
+    for (qsizetype i = 0; i <= text.size(); ++i) {
+        const bool isWordChar = (i < text.size()) && text.at(i).isLetterOrNumber();
+        if (isWordChar && (start < 0)) {
+            start = i;
+        } else if (!isWordChar && (start >= 0)) {
+            if ((i - start) >= 2)
+                tokens << text.mid(start, i - start).toLower();
+            start = -1;
+        }
+    }
+    tokens.removeDuplicates();
+    return tokens;
+}
+
+void Calendar::updateSearchIndex(qsizetype row, int delta)
+{
+    const QString &uid = m_store.m_strings.at(m_store.m_uid.at(row));
+    const auto tokens = searchTokens(m_store.summary(row));
+
+    for (const auto &token : tokens) {
+        auto &series = m_searchIndex[token];
+        int &count = series[uid];
+        count += delta;
+        if (count <= 0) {
+            series.remove(uid);
+            if (series.isEmpty())
+                m_searchIndex.remove(token);
+        }
+    }
+}
+
+QVector<int> Calendar::search(const QString &query, qint64 from, int limit) const
+{
+    const auto tokens = searchTokens(query);
+    if (tokens.isEmpty())
+        return { };
+
+    // every query token is a prefix match: all of them have to match the same series
+    QSet<QString> uids;
+    for (qsizetype t = 0; t < tokens.size(); ++t) {
+        const QString &token = tokens.at(t);
+        QSet<QString> matches;
+        for (auto it = m_searchIndex.lowerBound(token); (it != m_searchIndex.cend()) && it.key().startsWith(token); ++it) {
+            for (auto sit = it->cbegin(); sit != it->cend(); ++sit)
+                matches.insert(sit.key());
+        }
+        uids = (t == 0) ? matches : uids.intersect(matches);
+        if (uids.isEmpty())
+            return { };
+    }
 
-    if (!m_lastETag.isEmpty())
-        request.setHeader(QNetworkRequest::IfNoneMatchHeader, m_lastETag);
-    qDebug() << "Fetching calendar from" << m_url;
+    // the rows of a series are contiguous within each source, as the store is sorted by key
+    auto rowLessThan = [this](qsizetype row, int source, const QString &uid) {
+        if (m_store.m_source.at(row) != source)
+            return m_store.m_source.at(row) < source;
+        return m_store.m_strings.at(m_store.m_uid.at(row)) < uid;
+    };
+
+    QVector<int> rows;
+    for (const auto &uid : std::as_const(uids)) {
+        for (int source = 0; source < m_sources.size(); ++source) {
+            qsizetype lo = 0;
+            qsizetype hi = m_store.size();
+            while (lo < hi) {
+                const qsizetype mid = (lo + hi) / 2;
+                if (rowLessThan(mid, source, uid))
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            for (qsizetype row = lo; (row < m_store.size()) && (m_store.m_source.at(row) == source)
+                 && (m_store.m_strings.at(m_store.m_uid.at(row)) == uid); ++row) {
+                if (m_store.m_end.at(row) >= from)
+                    rows.append(int(row));
+            }
+        }
+    }
+
+    std::sort(rows.begin(), rows.end(), [this](int r1, int r2) {
+        return m_store.m_start.at(r1) < m_store.m_start.at(r2);
+    });
+    if ((limit > 0) && (rows.size() > limit))
+        rows.resize(limit);
+    return rows;
+}
+
+QVector<int> Calendar::overlappingRows(qint64 from, qint64 to) const
+{
+    auto &index = m_intervalIndex;
+
+    if (index.m_dirty) {
+        const qsizetype count = m_store.size();
+        index.m_rows.resize(count);
+        std::iota(index.m_rows.begin(), index.m_rows.end(), 0);
+        std::sort(index.m_rows.begin(), index.m_rows.end(), [this](int r1, int r2) {
+            return m_store.m_start.at(r1) < m_store.m_start.at(r2);
+        });
+        index.m_starts.resize(count);
+        index.m_maxEnds.resize(count);
+        qint64 maxEnd = std::numeric_limits<qint64>::min();
+        for (qsizetype i = 0; i < count; ++i) {
+            const int row = index.m_rows.at(i);
+            index.m_starts[i] = m_store.m_start.at(row);
+            maxEnd = qMax(maxEnd, m_store.m_end.at(row));
+            index.m_maxEnds[i] = maxEnd;
+        }
+        index.m_dirty = false;
+    }
+
+    // everything before lo ends before from, everything from hi on starts after to
+    const auto lo = std::lower_bound(index.m_maxEnds.cbegin(), index.m_maxEnds.cend(), from)
+            - index.m_maxEnds.cbegin();
+    const auto hi = std::lower_bound(index.m_starts.cbegin(), index.m_starts.cend(), to)
+            - index.m_starts.cbegin();
+
+    QVector<int> rows;
+    for (auto i = lo; i < hi; ++i) {
+        const int row = index.m_rows.at(i);
+        // zero length entries (to-dos) right at from still count
+        if ((m_store.m_end.at(row) > from) || (m_store.m_start.at(row) >= from))
+            rows.append(row);
+    }
+    return rows;
+}
+
+QList<int> Calendar::dayDensity(const QDate &from, int days) const
+{
+    if (!from.isValid() || (days <= 0))
+        return { };
+
+    // local day boundaries: days can be 23 or 25 hours long
+    QVector<qint64> boundaries(days + 1);
+    for (int d = 0; d <= days; ++d)
+        boundaries[d] = QDateTime(from.addDays(d), QTime(0, 0)).toSecsSinceEpoch();
+
+    QList<int> counts(days, 0);
+    const auto rows = overlappingRows(boundaries.constFirst(), boundaries.constLast());
+    for (const int row : rows) {
+        const qint64 start = m_store.m_start.at(row);
+        const qint64 end = qMax(m_store.m_end.at(row), start + 1); // count to-dos on their day
+
+        auto d = std::upper_bound(boundaries.cbegin(), boundaries.cend(), start) - boundaries.cbegin() - 1;
+        for (d = qMax<qsizetype>(d, 0); (d < days) && (boundaries.at(d) < end); ++d)
+            ++counts[d];
+    }
+    return counts;
+}
+
+QList<int> Calendar::busyIntervals(const QDateTime &from, const QDateTime &to) const
+{
+    if (!from.isValid() || !to.isValid() || (to <= from))
+        return { };
+
+    const qint64 fromSecs = from.toSecsSinceEpoch();
+    const qint64 toSecs = to.toSecsSinceEpoch();
+
+    QVector<std::pair<qint64, qint64>> intervals;
+    const auto rows = overlappingRows(fromSecs, toSecs);
+    for (const int row : rows) {
+        if (m_store.m_flags.at(row) & (AllDayFlag | TodoFlag))
+            continue;
+        const qint64 start = qMax(m_store.m_start.at(row), fromSecs);
+        const qint64 end = qMin(m_store.m_end.at(row), toSecs);
+        if (end > start)
+            intervals.append({ start, end });
+    }
+    // overlappingRows() is ordered by the unclipped start, so we have to sort again
+    std::sort(intervals.begin(), intervals.end());
+
+    QList<int> result;
+    for (const auto &[start, end] : std::as_const(intervals)) {
+        const int startMin = int((start - fromSecs) / 60);
+        const int endMin = int((end - fromSecs + 59) / 60);
+
+        if (!result.isEmpty() && (startMin <= result.constLast()))
+            result.last() = qMax(result.constLast(), endMin);
+        else
+            result << startMin << endMin;
+    }
+    return result;
+}
+
+void Calendar::updateReminders()
+{
+    // Every model update invalidates the row numbers, so we just rebuild the heap: this is linear
+    // in the number of alarms and much cheaper than the diffing itself.
+    m_reminders.clear();
+    for (qsizetype row = 0; row < m_store.size(); ++row) {
+        for (const qint32 offset : m_store.m_alarms.at(row)) {
+            const qint64 time = m_store.m_start.at(row) + offset;
+            if (time > m_remindersFiredUntil)
+                m_reminders.append({ time, int(row) });
+        }
+    }
+    std::make_heap(m_reminders.begin(), m_reminders.end(), std::greater<Reminder>());
+    scheduleReminderTimer();
+}
+
+void Calendar::scheduleReminderTimer()
+{
+    if (m_reminders.isEmpty()) {
+        m_reminderTimer->stop();
+        return;
+    }
+    // re-check at least every hour: the wall clock might jump (NTP sync, suspend)
+    const qint64 secs = m_reminders.constFirst().m_time - QDateTime::currentSecsSinceEpoch();
+    m_reminderTimer->start(int(qBound<qint64>(0, secs, 60 * 60) * 1000));
+}
+
+void Calendar::fireReminders()
+{
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    while (!m_reminders.isEmpty() && (m_reminders.constFirst().m_time <= now)) {
+        const int row = m_reminders.constFirst().m_row;
+        std::pop_heap(m_reminders.begin(), m_reminders.end(), std::greater<Reminder>());
+        m_reminders.removeLast();
+        emit reminderDue(get(row));
+    }
+    m_remindersFiredUntil = qMax(m_remindersFiredUntil, now);
+    scheduleReminderTimer();
+}
+
+void Calendar::load(bool force)
+{
+    if (m_disabled)
+        return;
+
+    // all sources are fetched concurrently over the shared QNAM
+    for (auto *source : std::as_const(m_sources))
+        load(source, force);
+}
+
+void Calendar::load(Source *source, bool force)
+{
+    // concurrent reload requests are folded into the one already running
+    if (source->m_isLoading)
+        return;
+
+    if (!force && (source->m_errorCount == 0) && source->m_freshUntil.isValid()
+            && (QDateTime::currentDateTimeUtc() < source->m_freshUntil)) {
+        qDebug() << "Calendar from" << source->m_config.m_url.toDisplayString(QUrl::RemoveUserInfo)
+                 << "is still fresh until" << source->m_freshUntil.toLocalTime();
+        scheduleRefresh(source);
+        return;
+    }
+
+    if (source->m_config.m_calDav) {
+        loadCalDav(source);
+        return;
+    }
+
+    QNetworkRequest request(source->m_config.m_url);
+
+    // the validators are only restored together with the parsed data in loadCache(), so an
+    // unchanged calendar costs no bandwidth and no parsing
+    if (!source->m_lastETag.isEmpty())
+        request.setHeader(QNetworkRequest::IfNoneMatchHeader, source->m_lastETag);
+    if (!source->m_lastModified.isEmpty())
+        request.setRawHeader("If-Modified-Since", source->m_lastModified.toLatin1());
+    qDebug() << "Fetching calendar from" << source->m_config.m_url.toDisplayString(QUrl::RemoveUserInfo);
     auto *reply = m_nam->get(request);
+    connect(reply, &QNetworkReply::finished, this, [this, source, reply]() {
+        handleNetworkReply(source, reply);
+    });
 
-    m_isLoading = (reply);
-    if (m_isLoading)
-        emit isLoadingChanged(m_isLoading);
+    source->m_isLoading = true;
+    updateLoading();
+}
+
+static constexpr quint32 CacheMagic = 0x48414351; // HACQ
+static constexpr quint32 CacheVersion = 8; // bump this whenever Entry, the format or the parsing changes
+
+QString Calendar::cacheFileName(const SourceConfiguration &config)
+{
+    QDir cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    auto urlHash = QCryptographicHash::hash(config.m_url.toEncoded(), QCryptographicHash::Sha1);
+    return cacheDir.absoluteFilePath(u"calendar-"_qs + QString::fromLatin1(urlHash.toHex()) + u".cache"_qs);
+}
+
+void Calendar::loadCache(Source *source)
+{
+    QFile f(cacheFileName(source->m_config));
+    if (!f.open(QIODevice::ReadOnly))
+        return;
+
+    QDataStream ds(&f);
+    ds.setVersion(QDataStream::Qt_6_5);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    ds >> magic >> version;
+    if ((magic != CacheMagic) || (version != CacheVersion))
+        return;
+
+    QString lastETag;
+    QString lastModified;
+    QDateTime freshUntil;
+    QString syncToken;
+    QMap<QString, QByteArray> davResources;
+    ComponentCache componentCache;
+    ds >> lastETag >> lastModified >> freshUntil >> syncToken >> davResources >> componentCache;
+
+    if (ds.status() != QDataStream::Ok) {
+        qWarning() << "Calendar: ignoring corrupt cache file" << f.fileName();
+        return;
+    }
+
+    QVector<Entry> entries;
+    for (auto it = componentCache.begin(); it != componentCache.end(); ++it) {
+        for (auto &entry : *it)
+            entry.m_source = source->m_index;
+        entries.append(*it);
+    }
+    sortEntries(entries);
+
+    // only restore the ETag and sync-token if we can also restore the matching data
+    source->m_lastETag = lastETag;
+    source->m_lastModified = lastModified;
+    source->m_freshUntil = freshUntil;
+    source->m_syncToken = syncToken;
+    source->m_davResources = davResources;
+    source->m_componentCache = componentCache;
+    updateEntries(source->m_index, entries);
+
+    qDebug() << "Calendar: restored" << entries.size() << "entries from the cache for"
+             << source->m_config.m_url.toDisplayString(QUrl::RemoveUserInfo);
+}
+
+void Calendar::saveCache(const Source *source) const
+{
+    QDir().mkpath(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+
+    QSaveFile f(cacheFileName(source->m_config));
+    if (!f.open(QIODevice::WriteOnly)) {
+        qWarning() << "Calendar: cannot write cache file" << f.fileName() << ":" << f.errorString();
+        return;
+    }
+
+    QDataStream ds(&f);
+    ds.setVersion(QDataStream::Qt_6_5);
+    ds << CacheMagic << CacheVersion
+       << source->m_lastETag << source->m_lastModified << source->m_freshUntil << source->m_syncToken
+       << source->m_davResources << source->m_componentCache;
+
+    if (ds.status() == QDataStream::Ok)
+        f.commit();
+}
+
+quint64 Calendar::fingerprint(QByteArrayView data)
+{
+    // qHash() is only 32 bits wide on 32-bit platforms (e.g. the Raspberry Pi), which is not good
+    // enough to rule out collisions on large calendars
+    if constexpr (sizeof(size_t) >= sizeof(quint64))
+        return qHash(data, 0);
+    else
+        return (quint64(qHash(data, 0)) << 32) | quint64(qHash(data, 0x9e3779b9));
+}
+
+quint64 Calendar::combineFingerprints(quint64 fp1, quint64 fp2)
+{
+    // the 64-bit variant of boost::hash_combine
+    return fp1 ^ (fp2 + 0x9e3779b97f4a7c15ULL + (fp1 << 6) + (fp1 >> 2));
 }
 
 // run via QtConcurrent in separate thread
-QVector<Calendar::Entry> Calendar::parseNetworkReply(const QByteArray &data)
+Calendar::ParseResult Calendar::parseNetworkReply(int source, const QByteArray &data, const ComponentCache &componentCache)
+{
+    // Most of a calendar doesn't change between two fetches: we split the raw data into VEVENT
+    // and VTODO blocks and fingerprint each one, so that only new or changed blocks need to be parsed and
+    // expanded. Everything else is taken from the cache of the last run.
+    // The first pass is a quick scan for the block boundaries. The VTIMEZONE definitions are
+    // parsed right away, because all the components might depend on them. For the same reason,
+    // they are part of every component's fingerprint: a changed zone definition changes the UTC
+    // times of all the entries using it.
+
+    struct Block
+    {
+        quint64 m_fingerprint;
+        QByteArrayView m_data;
+    };
+
+    ParseResult result;
+    QVector<Block> components;
+    ICalendarParser::TimeZones timeZones;
+    quint64 timeZonesFingerprint = 0;
+    qsizetype pos = 0;
+    qsizetype blockStart = -1;
+    QByteArrayView blockEndLine;
+    qsizetype timeZoneStart = -1;
+
+    while (pos < data.size()) {
+        qsizetype eol = data.indexOf('\n', pos);
+        if (eol < 0)
+            eol = data.size();
+        const QByteArrayView line = QByteArrayView(data).sliced(pos, eol - pos).trimmed();
+
+        if (line.compare("BEGIN:VTIMEZONE", Qt::CaseInsensitive) == 0) {
+            timeZoneStart = pos;
+        } else if ((timeZoneStart >= 0) && (line.compare("END:VTIMEZONE", Qt::CaseInsensitive) == 0)) {
+            const QByteArray timeZone = data.sliced(timeZoneStart, qMin(eol + 1, data.size()) - timeZoneStart);
+            timeZonesFingerprint = combineFingerprints(timeZonesFingerprint, fingerprint(timeZone));
+
+            // the zones that the system doesn't know are only valid for this calendar
+            ICalendarParser p(timeZone);
+            p.setTimeZones(timeZones);
+            try {
+                p.parse();
+                timeZones = p.timeZones();
+            } catch (const std::exception &e) {
+                qWarning().noquote() << "iCalendar parse error:" << e.what();
+            }
+            timeZoneStart = -1;
+        } else if ((blockStart < 0) && (line.compare("BEGIN:VEVENT", Qt::CaseInsensitive) == 0)) {
+            blockStart = pos;
+            blockEndLine = "END:VEVENT";
+        } else if ((blockStart < 0) && (line.compare("BEGIN:VTODO", Qt::CaseInsensitive) == 0)) {
+            blockStart = pos;
+            blockEndLine = "END:VTODO";
+        } else if ((blockStart >= 0) && (line.compare(blockEndLine, Qt::CaseInsensitive) == 0)) {
+            const qsizetype blockEnd = qMin(eol + 1, data.size());
+            const QByteArrayView block = QByteArrayView(data).sliced(blockStart, blockEnd - blockStart);
+            components.append({ fingerprint(block), block });
+            blockStart = -1;
+        }
+        pos = eol + 1;
+    }
+
+    // VTIMEZONEs may also follow the components, so the lookup has to wait until the end
+    QVector<Block> blocks;
+    for (auto &component : components) {
+        component.m_fingerprint = combineFingerprints(component.m_fingerprint, timeZonesFingerprint);
+
+        auto it = componentCache.constFind(component.m_fingerprint);
+        if (it != componentCache.cend())
+            result.m_components.insert(component.m_fingerprint, *it);
+        else
+            blocks.append(component);
+    }
+
+    // Parsing and expanding the new or changed components is independent for each block, so we
+    // can spread that work over all cores. This thread participates while it is blocked, so this
+    // is safe to use from within a thread pool worker.
+    using ParsedBlock = std::pair<quint64, QVector<Entry>>;
+
+    const ComponentCache parsed = QtConcurrent::blockingMappedReduced<ComponentCache>(blocks,
+        [source, &timeZones](const Block &block) {
+            return ParsedBlock { block.m_fingerprint,
+                                 parseComponent(source, block.m_data.toByteArray(), timeZones) };
+        },
+        [](ComponentCache &cache, const ParsedBlock &parsedBlock) {
+            cache.insert(parsedBlock.first, parsedBlock.second);
+        }, QtConcurrent::UnorderedReduce);
+
+    result.m_components.insert(parsed);
+
+    qDebug() << "Calendar: parsed" << parsed.size() << "of" << result.m_components.size()
+             << "components, the rest was unchanged";
+
+    // the final merge: the order of the components doesn't matter, as we sort by key anyway
+    qsizetype entryCount = 0;
+    for (const auto &entries : std::as_const(result.m_components))
+        entryCount += entries.size();
+    result.m_entries.reserve(entryCount);
+    for (const auto &entries : std::as_const(result.m_components))
+        result.m_entries.append(entries);
+
+    sortEntries(result.m_entries);
+    return result;
+}
+
+void Calendar::sortEntries(QVector<Entry> &entries)
+{
+    // The model diffing in updateEntries() needs unique, sorted keys. A RECURRENCE-ID override
+    // has the same key as the occurrence it replaces, so it is sorted first and wins.
+    std::sort(entries.begin(), entries.end(), [](const Entry &e1, const Entry &e2) {
+        if (Entry::keyLessThan(e1, e2))
+            return true;
+        if (Entry::keyLessThan(e2, e1))
+            return false;
+        return (e1.m_flags & OverrideFlag) > (e2.m_flags & OverrideFlag);
+    });
+    entries.erase(std::unique(entries.begin(), entries.end(), [](const Entry &e1, const Entry &e2) {
+                      return !Entry::keyLessThan(e1, e2) && !Entry::keyLessThan(e2, e1);
+                  }), entries.end());
+    entries.removeIf([](const Entry &e) { return e.m_flags & CancelledFlag; });
+}
+
+void Calendar::appendEpochSecs(QVector<qint64> &list, const QVariant &value)
+{
+    // RDATE and EXDATE can be DATE-TIME or DATE lists
+    if (value.metaType() == QMetaType::fromType<QList<QDateTime>>()) {
+        const auto dateTimes = value.value<QList<QDateTime>>();
+        for (const auto &dt : dateTimes)
+            list.append(dt.toSecsSinceEpoch());
+    } else if (value.metaType() == QMetaType::fromType<QList<QDate>>()) {
+        const auto dates = value.value<QList<QDate>>();
+        for (const auto &d : dates)
+            list.append(QDateTime(d, QTime(0, 0)).toSecsSinceEpoch());
+    } else if (value.canConvert<QDateTime>()) {
+        list.append(value.toDateTime().toSecsSinceEpoch());
+    }
+}
+
+QVector<qint64> Calendar::mergeOccurrences(const QVector<qint64> &generated, QVector<qint64> extra,
+                                           QVector<qint64> exceptions)
+{
+    // (generated + RDATEs) - EXDATEs in one linear pass over the sorted lists
+    std::sort(extra.begin(), extra.end());
+    std::sort(exceptions.begin(), exceptions.end());
+
+    QVector<qint64> result;
+    result.reserve(generated.size() + extra.size());
+    qsizetype g = 0;
+    qsizetype r = 0;
+    qsizetype x = 0;
+
+    while ((g < generated.size()) || (r < extra.size())) {
+        qint64 t;
+        if ((r >= extra.size()) || ((g < generated.size()) && (generated.at(g) <= extra.at(r))))
+            t = generated.at(g++);
+        else
+            t = extra.at(r++);
+
+        while ((x < exceptions.size()) && (exceptions.at(x) < t))
+            ++x;
+        if ((x < exceptions.size()) && (exceptions.at(x) == t))
+            continue;
+        if (!result.isEmpty() && (result.constLast() == t))
+            continue;
+        result.append(t);
+    }
+    return result;
+}
+
+QVector<Calendar::Entry> Calendar::parseComponent(int source, const QByteArray &data,
+                                                  const ICalendarParser::TimeZones &timeZones)
 {
     ICalendarParser p(data);
+    p.setTimeZones(timeZones);
 
     QVector<Entry> entries;
 
@@ -158,26 +967,77 @@ QVector<Calendar::Entry> Calendar::parseNetworkReply(const QByteArray &data)
         p.parse();
         auto result = p.result();
 
-        bool parsingEntry = false;
-        Entry current;
+        QString parsingEntry; // VEVENT or VTODO
+        QString parsingSubComponent; // VALARM or anything unknown
+        struct {
+            QString m_uid;
+            QString m_summary;
+            QDateTime m_start;
+            QDateTime m_end;
+            QDateTime m_due;
+            QDateTime m_recurrenceId;
+            qint64 m_duration = -1;
+            bool m_completed = false; // COMPLETED or STATUS:COMPLETED, only relevant for to-dos
+            bool m_cancelled = false; // STATUS:CANCELLED
+        } current;
+        struct Alarm {
+            qint64 m_offset = 0; // relative to the start, or to the end if m_relatedToEnd
+            QDateTime m_absolute;
+            bool m_relatedToEnd = false;
+            bool m_valid = false;
+        } alarm;
+        QList<Alarm> alarms;
         ICalendarRecurrence recurrenceRules;
-        QList<QDateTime> recurrenceDates;
-        QList<QDateTime> recurrenceExceptionDates;
+        QVector<qint64> recurrenceDates;
+        QVector<qint64> recurrenceExceptionDates;
 
 
         for (const ICalendarParser::ContentLine &line : result) {
-            if (line.name == u"BEGIN" && line.value.toString() == u"VEVENT" && !parsingEntry) {
-                parsingEntry = true;
-            } else if (line.name == u"END" && line.value.toString() == u"VEVENT" && parsingEntry) {
-                parsingEntry = false;
-                if (current.m_start.isValid()) {
-                    QVector<QDateTime> startTimes = { current.m_start };
+            if (line.name == u"BEGIN" && parsingEntry.isEmpty()) {
+                const QString component = line.value.toString();
+                if ((component == u"VEVENT") || (component == u"VTODO"))
+                    parsingEntry = component;
+            } else if (line.name == u"BEGIN" && parsingSubComponent.isEmpty()) {
+                parsingSubComponent = line.value.toString();
+                alarm = Alarm { };
+            } else if (line.name == u"END" && !parsingSubComponent.isEmpty()) {
+                if (line.value.toString() == parsingSubComponent) {
+                    if ((parsingSubComponent == u"VALARM") && alarm.m_valid)
+                        alarms << alarm;
+                    parsingSubComponent.clear();
+                }
+            } else if (line.name == u"END" && line.value.toString() == parsingEntry) {
+                const bool isTodo = (parsingEntry == u"VTODO");
+                parsingEntry.clear();
+
+                if (isTodo) {
+                    // we show to-dos as a point in time: the due date if there is one
+                    if (current.m_due.isValid())
+                        current.m_start = current.m_due;
+                    current.m_end = current.m_start;
+                } else if (!current.m_end.isValid() && (current.m_duration >= 0)) {
+                    current.m_end = current.m_start.addSecs(current.m_duration);
+                }
+
+                // done to-dos are skipped, while cancelled events are still shown (as before).
+                // Only a cancelled or done override removes its generated occurrence.
+                const bool isDone = isTodo && (current.m_completed || current.m_cancelled);
+                const bool isOverride = current.m_recurrenceId.isValid();
+                const bool removesOccurrence = isOverride && (isDone || current.m_cancelled);
+
+                if (current.m_start.isValid() && (!isDone || isOverride)) {
+                    if (current.m_uid.isEmpty()) // not RFC compliant, but better than nothing
+                        current.m_uid = current.m_summary + u'@' + current.m_start.toString(Qt::ISODate);
+
+                    const QTimeZone tz = current.m_start.timeZone();
+                    const int startDSTOffset = tz.daylightTimeOffset(current.m_start);
                     auto diffTime = current.m_start.secsTo(current.m_end);
 
-                    for (const auto &recDate : recurrenceDates)
-                        startTimes.append(recDate);
+                    // all occurrences as sorted secs since epoch: the rule generated ones are
+                    // ascending by definition
+                    QVector<qint64> startTimes = { current.m_start.toSecsSinceEpoch() };
 
-                    if (recurrenceRules.isValid()) {
+                    if (recurrenceRules.isValid() && !isOverride) {
                         int interval = qMax(1, recurrenceRules.m_interval);
                         int addSecs = 0;
                         int addMonths = 0;
@@ -207,34 +1067,48 @@ QVector<Calendar::Entry> Calendar::parseNetworkReply(const QByteArray &data)
                             if (count >= maxCount)
                                 break;
 
-                            //                                qWarning() << "RECUR" << current.m_summary << current.m_start.toString(Qt::SystemLocaleShortDate)
-                            //                                           << "ADD" << addSecs << addMonths << " --> " << startTime.toString(Qt::SystemLocaleShortDate);
-                            startTimes.append(startTime);
+                            // Fix the DST offset. A meeting scheduled at 10:00 will be at that
+                            // time, regardless of the current DST offset. addMonths() already
+                            // keeps the local time.
+                            const int isDSTOffset = addSecs ? tz.daylightTimeOffset(startTime) : startDSTOffset;
+                            const QDateTime fixedTime = (isDSTOffset != startDSTOffset)
+                                    ? startTime.addSecs(startDSTOffset - isDSTOffset) : startTime;
+
+                            startTimes.append(fixedTime.toSecsSinceEpoch());
                         }
                     }
-                    for (const auto &excDate : recurrenceExceptionDates)
-                        startTimes.removeAll(excDate);
-
-                    for (const QDateTime &dt : startTimes) {
-                        // Fix the DST offset. A meeting scheduled at 10:00 will be at that time,
-                        // regardless of the current DST offset.
 
-                        QTimeZone tz = current.m_start.timeZone();
-                        int wasDSTOffset = tz.daylightTimeOffset(current.m_start);
-                        int isDSTOffset = tz.daylightTimeOffset(dt);
+                    if (!isOverride && (!recurrenceDates.isEmpty() || !recurrenceExceptionDates.isEmpty()))
+                        startTimes = mergeOccurrences(startTimes, recurrenceDates, recurrenceExceptionDates);
 
-                        QDateTime startTime = (isDSTOffset != wasDSTOffset)
-                                ? dt.addSecs(wasDSTOffset - isDSTOffset) : dt;
-
-                        //qWarning() << current.m_summary << dt << "timeZone" << tz << "isDST" << isDSTOffset << "wasDST" << wasDSTOffset << " -> " << startTime;
+                    const qint64 recurrenceId = isOverride ? current.m_recurrenceId.toSecsSinceEpoch() : 0;
 
+                    for (const qint64 secs : std::as_const(startTimes)) {
+                        const QDateTime startTime = QDateTime::fromSecsSinceEpoch(secs, current.m_start.timeRepresentation());
                         QDateTime endTime = startTime.addSecs(diffTime);
                         bool allDay = (startTime.time().hour() == 0 && startTime.time().minute() == 0)
                                 && ((endTime.time().hour() == 0 && endTime.time().minute() == 0)
                                     || (endTime.time().hour() == 23 && endTime.time().minute() == 59));
 
                         bool sameDay = (startTime.date() == endTime.date());
-                        entries << Entry { current.m_summary, startTime, endTime, diffTime, allDay, sameDay };
+                        quint8 flags = (allDay ? AllDayFlag : 0) | (sameDay ? SameDayFlag : 0)
+                                | (isTodo ? TodoFlag : 0) | (isOverride ? OverrideFlag : 0)
+                                | (removesOccurrence ? CancelledFlag : 0);
+
+                        QList<qint32> alarmOffsets;
+                        for (const auto &a : std::as_const(alarms)) {
+                            if (a.m_absolute.isValid()) {
+                                // an absolute trigger only applies to the first occurrence
+                                if (secs == startTimes.constFirst())
+                                    alarmOffsets << qint32(startTime.secsTo(a.m_absolute));
+                            } else {
+                                alarmOffsets << qint32(a.m_offset + (a.m_relatedToEnd ? diffTime : 0));
+                            }
+                        }
+
+                        entries << Entry { source, current.m_uid, isOverride ? recurrenceId : secs, current.m_summary,
+                                           startTime.toSecsSinceEpoch(), endTime.toSecsSinceEpoch(),
+                                           startTime.timeRepresentation(), flags, alarmOffsets };
                     }
                     //                        if (recurrenceRules.isValid()) {
                     //                            qWarning() << current.m_summary << "from" << current.m_start.toString(Qt::SystemLocaleShortDate) << "to"
@@ -242,23 +1116,53 @@ QVector<Calendar::Entry> Calendar::parseNetworkReply(const QByteArray &data)
                     //                                       << "except?" << recurrenceExceptionDates;
                     //                        }
                 }
-                current = Entry();
+                current = { };
+                alarms.clear();
                 recurrenceRules = ICalendarRecurrence();
                 recurrenceDates.clear();
                 recurrenceExceptionDates.clear();
-            } else if (parsingEntry) {
-                if (line.name == u"DTSTART") {
+            } else if (parsingSubComponent == u"VALARM") {
+                if (line.name == u"TRIGGER") {
+                    if (line.value.typeId() == QMetaType::QDateTime) {
+                        alarm.m_absolute = line.value.toDateTime();
+                    } else {
+                        alarm.m_offset = line.value.toLongLong();
+                        for (const auto &parameter : line.parameters) {
+                            if (parameter.first == u"RELATED")
+                                alarm.m_relatedToEnd = parameter.second.contains(u"END"_qs);
+                        }
+                    }
+                    alarm.m_valid = true;
+                }
+            } else if (!parsingEntry.isEmpty() && parsingSubComponent.isEmpty()) {
+                if (line.name == u"UID") {
+                    current.m_uid = line.value.toString();
+                } else if (line.name == u"DTSTART") {
                     current.m_start = line.value.toDateTime();
                 } else if (line.name == u"DTEND") {
                     current.m_end = line.value.toDateTime();
+                } else if (line.name == u"DUE") {
+                    current.m_due = line.value.toDateTime();
+                } else if (line.name == u"DURATION") {
+                    current.m_duration = line.value.toLongLong();
+                } else if (line.name == u"COMPLETED") {
+                    current.m_completed = true;
+                } else if (line.name == u"STATUS") {
+                    const QString status = line.value.toString();
+                    if (status == u"COMPLETED")
+                        current.m_completed = true;
+                    else if (status == u"CANCELLED")
+                        current.m_cancelled = true;
                 } else if (line.name == u"SUMMARY") {
                     current.m_summary = line.value.toString();
                 } else if (line.name == u"RRULE") {
                     recurrenceRules = line.value.value<ICalendarRecurrence>();
-                } else if (line.name == u"RDATA") {
-                    recurrenceDates.append(line.value.value<QList<QDateTime>>());
-                } else if (line.name == u"EXDATA") {
-                    recurrenceExceptionDates.append(line.value.value<QList<QDateTime>>());
+                } else if (line.name == u"RDATE") {
+                    appendEpochSecs(recurrenceDates, line.value);
+                } else if (line.name == u"EXDATE") {
+                    appendEpochSecs(recurrenceExceptionDates, line.value);
+                } else if (line.name == u"RECURRENCE-ID") {
+                    current.m_recurrenceId = line.value.toDateTime();
                 }
             }
         }
@@ -269,41 +1173,329 @@ QVector<Calendar::Entry> Calendar::parseNetworkReply(const QByteArray &data)
     return entries;
 }
 
-void Calendar::handleNetworkReply(QNetworkReply *reply)
+void Calendar::handleNetworkReply(Source *source, QNetworkReply *reply)
 {
-    bool stillLoading = false;
+    reply->deleteLater();
+
     QString etag = reply->header(QNetworkRequest::ETagHeader).toString();
     bool etagValid = !etag.isEmpty();
+    QString lastModified = QString::fromLatin1(reply->rawHeader("Last-Modified"));
 
     if (reply->error() != QNetworkReply::NoError) {
-        qWarning() << "Failed to retrieve calendar from" << reply->url() << ":" << reply->errorString();
-    } else if ((etagValid && (etag == m_lastETag)) || (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304)) {
-        qDebug() << "ETAG matches on" << (reply->operation() == QNetworkAccessManager::HeadOperation ? "HEAD" : "GET") << "operation -> no changes";
-    } else if ((reply->operation() == QNetworkAccessManager::HeadOperation) && (etagValid && (etag != m_lastETag))) {
-        qDebug() << "HEAD says we have new entries -> issue GET";
-        m_nam->get(reply->request());
-        stillLoading = true;
+        qWarning() << "Failed to retrieve calendar from" << reply->url().toDisplayString(QUrl::RemoveUserInfo)
+                   << ":" << reply->errorString();
+        finishLoading(source, true);
+        return;
+    }
+
+    source->m_freshUntil = freshUntil(reply);
+
+    // the freshness of a 304 is not persisted: rewriting the whole cache just for that is not
+    // worth it, the worst case is an early revalidation after a restart
+    if ((reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304)
+            || (etagValid && (etag == source->m_lastETag))) {
+        qDebug() << "Calendar was not modified";
+        finishLoading(source);
+    } else {
+        source->m_lastETag = etag;
+        source->m_lastModified = lastModified;
+        parse(source, reply->readAll());
+    }
+}
+
+QDateTime Calendar::freshUntil(const QNetworkReply *reply)
+{
+    // RFC 9111: max-age wins over Expires
+    const auto now = QDateTime::currentDateTimeUtc();
+    const QByteArray cacheControl = reply->rawHeader("Cache-Control").toLower();
+    if (cacheControl.contains("no-cache") || cacheControl.contains("no-store"))
+        return now;
+
+    const auto directives = cacheControl.split(',');
+    for (const auto &directive : directives) {
+        const QByteArray d = directive.trimmed();
+        if (d.startsWith("max-age=")) {
+            bool ok = false;
+            qint64 maxAge = d.mid(8).toLongLong(&ok);
+            if (ok)
+                return now.addSecs(qMax<qint64>(0, maxAge));
+        }
+    }
+
+    const QByteArray expires = reply->rawHeader("Expires");
+    if (!expires.isEmpty()) {
+        QDateTime dt = QDateTime::fromString(QString::fromLatin1(expires), Qt::RFC2822Date);
+        // an invalid date means: already expired
+        return dt.isValid() ? dt.toUTC() : now;
+    }
+    return { };
+}
+
+void Calendar::finishLoading(Source *source, bool failed)
+{
+    source->m_errorCount = failed ? source->m_errorCount + 1 : 0;
+    source->m_isLoading = false;
+    updateLoading();
+    scheduleRefresh(source);
+}
+
+void Calendar::scheduleRefresh(Source *source)
+{
+    qint64 delay = 0; // sec
+
+    if (source->m_errorCount) {
+        // exponential back-off on errors: 1, 2, 4, ... minutes, but at most an hour
+        delay = qMin<qint64>(60LL << qMin(source->m_errorCount - 1, 6), 60 * 60);
+        if (source->m_config.m_refreshInterval > 0)
+            delay = qMin<qint64>(delay, source->m_config.m_refreshInterval);
+    } else if (source->m_config.m_refreshInterval > 0) {
+        delay = source->m_config.m_refreshInterval;
+        if (source->m_freshUntil.isValid())
+            delay = qMax(delay, QDateTime::currentDateTimeUtc().secsTo(source->m_freshUntil));
     } else {
-        m_lastETag = etag;
+        source->m_refreshTimer->stop();
+        return;
+    }
+    source->m_refreshTimer->start(int(qMin<qint64>(delay, 24 * 60 * 60) * 1000));
+}
+
+void Calendar::parse(Source *source, const QByteArray &data)
+{
+    // the global thread pool parses all sources in parallel
+    auto future = QtConcurrent::run(&Calendar::parseNetworkReply, source->m_index, data,
+                                    source->m_componentCache);
+    source->m_parserWatcher.setFuture(future);
+}
+
+void Calendar::loadCalDav(Source *source)
+{
+    // RFC 6578: only ask for the resources that changed since the last sync-token. An empty
+    // token gets us the complete list.
+
+    QByteArray body;
+    QXmlStreamWriter xml(&body);
+    xml.writeStartDocument();
+    xml.writeNamespace(u"DAV:"_qs, u"d"_qs);
+    xml.writeStartElement(u"DAV:"_qs, u"sync-collection"_qs);
+    xml.writeTextElement(u"DAV:"_qs, u"sync-token"_qs, source->m_syncToken);
+    xml.writeTextElement(u"DAV:"_qs, u"sync-level"_qs, u"1"_qs);
+    xml.writeStartElement(u"DAV:"_qs, u"prop"_qs);
+    xml.writeEmptyElement(u"DAV:"_qs, u"getetag"_qs);
+    xml.writeEndElement(); // prop
+    xml.writeEndElement(); // sync-collection
+    xml.writeEndDocument();
+
+    QNetworkRequest request(source->m_config.m_url);
+    request.setHeader(QNetworkRequest::ContentTypeHeader, u"application/xml; charset=utf-8"_qs);
+    request.setRawHeader("Depth", "0");
+
+    qDebug() << "Syncing CalDAV calendar from" << source->m_config.m_url.toDisplayString(QUrl::RemoveUserInfo)
+             << (source->m_syncToken.isEmpty() ? "(initial sync)" : "(incremental sync)");
+    auto *reply = m_nam->sendCustomRequest(request, "REPORT", body);
+    connect(reply, &QNetworkReply::finished, this, [this, source, reply]() {
+        handleCalDavSyncReply(source, reply);
+    });
+
+    source->m_isLoading = true;
+    updateLoading();
+}
+
+void Calendar::handleCalDavSyncReply(Source *source, QNetworkReply *reply)
+{
+    reply->deleteLater();
 
-        auto future = QtConcurrent::run(&Calendar::parseNetworkReply, this, reply->readAll());
-        m_parserWatcher.setFuture(future);
-        reply->deleteLater();
+    int httpStatus = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
-        beginResetModel();
-        m_entries.clear();
-        stillLoading = true;
+    if (!source->m_syncToken.isEmpty() && ((httpStatus == 403) || (httpStatus == 409))) {
+        // DAV:valid-sync-token precondition failed: the server forgot about our token
+        qDebug() << "CalDAV sync-token was rejected -> doing a full sync";
+        source->m_syncToken.clear();
+        source->m_isLoading = false;
+        loadCalDav(source);
+        return;
+    } else if (reply->error() != QNetworkReply::NoError) {
+        qWarning() << "Failed to sync CalDAV calendar from" << reply->url().toDisplayString(QUrl::RemoveUserInfo)
+                   << ":" << reply->errorString();
+        finishLoading(source, true);
+        return;
     }
 
-    m_isLoading = stillLoading;
-    if (!m_isLoading)
-        emit isLoadingChanged(m_isLoading);
+    QString syncToken;
+    const auto resources = parseDavMultiStatus(reply->readAll(), &syncToken);
+
+    bool initialSync = source->m_syncToken.isEmpty();
+    QSet<QString> unknownHrefs;
+    if (initialSync) {
+        for (auto it = source->m_davResources.cbegin(); it != source->m_davResources.cend(); ++it)
+            unknownHrefs.insert(it.key());
+    }
+
+    bool removedSome = false;
+    QStringList changedHrefs;
+
+    for (const auto &resource : resources) {
+        if (resource.m_href.endsWith(u'/')) // the collection itself
+            continue;
+        unknownHrefs.remove(resource.m_href);
+
+        if (resource.m_removed)
+            removedSome = (source->m_davResources.remove(resource.m_href) > 0) || removedSome;
+        else
+            changedHrefs << resource.m_href;
+    }
+    // a full sync also implicitly removes everything that was not listed anymore
+    for (const auto &href : std::as_const(unknownHrefs)) {
+        source->m_davResources.remove(href);
+        removedSome = true;
+    }
+
+    if (changedHrefs.isEmpty()) {
+        qDebug() << "CalDAV sync:" << (removedSome ? "some resources were removed" : "no changes");
+        source->m_syncToken = syncToken;
+        if (removedSome) {
+            parseCalDavResources(source);
+        } else {
+            saveCache(source);
+            finishLoading(source);
+        }
+        return;
+    }
+
+    qDebug() << "CalDAV sync:" << changedHrefs.size() << "resources changed";
+
+    QByteArray body;
+    QXmlStreamWriter xml(&body);
+    xml.writeStartDocument();
+    xml.writeNamespace(u"DAV:"_qs, u"d"_qs);
+    xml.writeNamespace(u"urn:ietf:params:xml:ns:caldav"_qs, u"c"_qs);
+    xml.writeStartElement(u"urn:ietf:params:xml:ns:caldav"_qs, u"calendar-multiget"_qs);
+    xml.writeStartElement(u"DAV:"_qs, u"prop"_qs);
+    xml.writeEmptyElement(u"DAV:"_qs, u"getetag"_qs);
+    xml.writeEmptyElement(u"urn:ietf:params:xml:ns:caldav"_qs, u"calendar-data"_qs);
+    xml.writeEndElement(); // prop
+    for (const auto &href : std::as_const(changedHrefs))
+        xml.writeTextElement(u"DAV:"_qs, u"href"_qs, href);
+    xml.writeEndElement(); // calendar-multiget
+    xml.writeEndDocument();
+
+    QNetworkRequest request(source->m_config.m_url);
+    request.setHeader(QNetworkRequest::ContentTypeHeader, u"application/xml; charset=utf-8"_qs);
+    request.setRawHeader("Depth", "1");
+
+    auto *multiGetReply = m_nam->sendCustomRequest(request, "REPORT", body);
+    connect(multiGetReply, &QNetworkReply::finished, this, [this, source, multiGetReply, syncToken]() {
+        handleCalDavMultiGetReply(source, multiGetReply, syncToken);
+    });
+}
+
+void Calendar::handleCalDavMultiGetReply(Source *source, QNetworkReply *reply, const QString &syncToken)
+{
+    reply->deleteLater();
+
+    if (reply->error() != QNetworkReply::NoError) {
+        // don't store the new sync-token: we want to see these changes again on the next sync
+        qWarning() << "Failed to fetch changed CalDAV resources from" << reply->url().toDisplayString(QUrl::RemoveUserInfo)
+                   << ":" << reply->errorString();
+        finishLoading(source, true);
+        return;
+    }
+
+    const auto resources = parseDavMultiStatus(reply->readAll(), nullptr);
+    for (const auto &resource : resources) {
+        if (resource.m_removed)
+            source->m_davResources.remove(resource.m_href);
+        else if (!resource.m_calendarData.isEmpty())
+            source->m_davResources.insert(resource.m_href, resource.m_calendarData);
+    }
+    source->m_syncToken = syncToken;
+    parseCalDavResources(source);
+}
+
+void Calendar::parseCalDavResources(Source *source)
+{
+    // Just concatenate all the resources and feed them into the normal ICS pipeline: the
+    // per-component cache makes sure that only the changed resources get parsed again.
+
+    QByteArray data;
+    for (const auto &calendarData : std::as_const(source->m_davResources)) {
+        data.append(calendarData);
+        if (!data.endsWith('\n'))
+            data.append("\r\n");
+    }
+    parse(source, data);
+}
+
+QList<Calendar::DavResource> Calendar::parseDavMultiStatus(const QByteArray &xml, QString *syncToken)
+{
+    static const auto davNS = u"DAV:"_qs;
+    static const auto calDavNS = u"urn:ietf:params:xml:ns:caldav"_qs;
+
+    QList<DavResource> resources;
+    QXmlStreamReader reader(xml);
+
+    DavResource current;
+    QByteArray propCalendarData;
+    bool inResponse = false;
+    bool inPropStat = false;
+
+    // 2xx in "HTTP/1.1 200 OK"
+    auto isSuccessStatus = [](const QString &status) {
+        return status.section(u' ', 1, 1).startsWith(u'2');
+    };
+
+    while (!reader.atEnd()) {
+        reader.readNext();
+
+        if (reader.isStartElement()) {
+            const auto ns = reader.namespaceUri();
+            const auto name = reader.name();
+
+            if (ns == davNS && name == u"response") {
+                current = DavResource { };
+                inResponse = true;
+            } else if (ns == davNS && name == u"propstat") {
+                propCalendarData.clear();
+                inPropStat = true;
+            } else if (inResponse && ns == davNS && name == u"href") {
+                current.m_href = reader.readElementText().trimmed();
+            } else if (inResponse && ns == davNS && name == u"status") {
+                const QString status = reader.readElementText().trimmed();
+                if (inPropStat) {
+                    if (isSuccessStatus(status))
+                        current.m_calendarData = propCalendarData;
+                } else if (status.section(u' ', 1, 1) == u"404") {
+                    current.m_removed = true;
+                }
+            } else if (inPropStat && ns == calDavNS && name == u"calendar-data") {
+                propCalendarData = reader.readElementText().toUtf8();
+            } else if (!inResponse && syncToken && ns == davNS && name == u"sync-token") {
+                *syncToken = reader.readElementText().trimmed();
+            }
+        } else if (reader.isEndElement()) {
+            const auto ns = reader.namespaceUri();
+            const auto name = reader.name();
+
+            if (ns == davNS && name == u"propstat") {
+                inPropStat = false;
+            } else if (ns == davNS && name == u"response") {
+                if (!current.m_href.isEmpty())
+                    resources << current;
+                inResponse = false;
+            }
+        }
+    }
+    if (reader.hasError())
+        qWarning() << "Failed to parse the CalDAV reply:" << reader.errorString();
+
+    return resources;
 }
 
 UpcomingCalendarEntries::UpcomingCalendarEntries(QObject *parent)
     : QSortFilterProxyModel(parent)
     , m_from(QDate::currentDate(), QTime(0, 0))
     , m_to(m_from.addDays(60))
+    , m_fromSecs(m_from.toSecsSinceEpoch())
+    , m_toSecs(m_to.toSecsSinceEpoch())
 {
     sort(0);
 
@@ -347,6 +1539,7 @@ void UpcomingCalendarEntries::setFrom(const QDateTime &from)
 {
     if (m_from != from) {
         m_from = from;
+        m_fromSecs = from.isValid() ? from.toSecsSinceEpoch() : std::numeric_limits<qint64>::min();
         invalidateFilter();
         emit fromChanged(m_from);
     }
@@ -356,6 +1549,7 @@ void UpcomingCalendarEntries::setTo(const QDateTime &to)
 {
     if (m_to != to) {
         m_to = to;
+        m_toSecs = to.isValid() ? to.toSecsSinceEpoch() : std::numeric_limits<qint64>::max();
         invalidateFilter();
         emit toChanged(m_to);
     }
@@ -366,19 +1560,204 @@ bool UpcomingCalendarEntries::filterAcceptsRow(int row, const QModelIndex &paren
     if (parent.isValid())
         return false;
 
-    const QDateTime &start = m_calendar->m_entries.at(row).m_start;
-    const QDateTime &end = m_calendar->m_entries.at(row).m_end;
-
-    return (end >= m_from) && (start <= m_to);
+    const auto &store = m_calendar->m_store;
+    return (store.m_end.at(row) >= m_fromSecs) && (store.m_start.at(row) <= m_toSecs);
 }
 
 bool UpcomingCalendarEntries::lessThan(const QModelIndex &index1, const QModelIndex &index2) const
 {
-    const QDateTime &start1 = m_calendar->m_entries.at(index1.row()).m_start;
-    const QDateTime &end1 = m_calendar->m_entries.at(index1.row()).m_end;
-    const QDateTime &start2 = m_calendar->m_entries.at(index2.row()).m_start;
-    const QDateTime &end2 = m_calendar->m_entries.at(index2.row()).m_end;
+    const auto &store = m_calendar->m_store;
+    const qint64 start1 = store.m_start.at(index1.row());
+    const qint64 start2 = store.m_start.at(index2.row());
+
+    return (start1 != start2) ? (start1 < start2)
+                              : (store.m_end.at(index1.row()) > store.m_end.at(index2.row()));
+}
+
+
+CalendarSearchModel::CalendarSearchModel(QObject *parent)
+    : QAbstractListModel(parent)
+{
+    connect(this, &QAbstractItemModel::modelReset, this, &CalendarSearchModel::countChanged);
+    connect(this, &QAbstractItemModel::rowsInserted, this, &CalendarSearchModel::countChanged);
+    connect(this, &QAbstractItemModel::rowsRemoved, this, &CalendarSearchModel::countChanged);
+}
+
+int CalendarSearchModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : int(m_rows.size());
+}
+
+QVariant CalendarSearchModel::data(const QModelIndex &index, int role) const
+{
+    if (!m_calendar || index.parent().isValid() || !index.isValid() || index.row() < 0 || index.row() >= m_rows.size()
+            || m_rows.at(index.row()) < 0)
+        return QVariant();
+    return m_calendar->data(m_calendar->index(m_rows.at(index.row())), role);
+}
 
-    return (start1 != start2) ? (start1 < start2) : (end1 > end2);
+QHash<int, QByteArray> CalendarSearchModel::roleNames() const
+{
+    return m_calendar ? m_calendar->roleNames() : QHash<int, QByteArray> { };
 }
 
+Calendar *CalendarSearchModel::calendar() const
+{
+    return m_calendar;
+}
+
+QString CalendarSearchModel::query() const
+{
+    return m_query;
+}
+
+int CalendarSearchModel::limit() const
+{
+    return m_limit;
+}
+
+QVariantMap CalendarSearchModel::get(int row) const
+{
+    if (!m_calendar || row < 0 || row >= m_rows.size() || m_rows.at(row) < 0)
+        return {};
+    return m_calendar->get(m_rows.at(row));
+}
+
+void CalendarSearchModel::setCalendar(Calendar *calendar)
+{
+    if (m_calendar == calendar)
+        return;
+
+    if (m_calendar)
+        disconnect(m_calendar, nullptr, this, nullptr);
+    m_calendar = calendar;
+    if (m_calendar) {
+        // A refresh arrives as a series of row changes, followed by entriesUpdated(). In between,
+        // we only keep our row numbers in sync with the calendar: the query is re-run and the
+        // result applied once, when the whole refresh is done.
+        connect(m_calendar, &QAbstractItemModel::rowsInserted, this, [this](const QModelIndex &, int first, int last) {
+            const int count = last - first + 1;
+            for (int &row : m_rows) {
+                if (row >= first)
+                    row += count;
+            }
+            QSet<int> changedRows;
+            for (int row : std::as_const(m_changedRows))
+                changedRows.insert((row >= first) ? row + count : row);
+            m_changedRows = changedRows;
+        });
+        connect(m_calendar, &QAbstractItemModel::rowsRemoved, this, [this](const QModelIndex &, int first, int last) {
+            const int count = last - first + 1;
+            for (int &row : m_rows) {
+                if (row > last)
+                    row -= count;
+                else if (row >= first)
+                    row = -1; // gone: removed from this model by the next update()
+            }
+            QSet<int> changedRows;
+            for (int row : std::as_const(m_changedRows)) {
+                if (row > last)
+                    changedRows.insert(row - count);
+                else if (row < first)
+                    changedRows.insert(row);
+            }
+            m_changedRows = changedRows;
+        });
+        connect(m_calendar, &QAbstractItemModel::dataChanged, this, [this](const QModelIndex &topLeft, const QModelIndex &bottomRight) {
+            for (int row : std::as_const(m_rows)) {
+                if ((row >= topLeft.row()) && (row <= bottomRight.row()))
+                    m_changedRows.insert(row);
+            }
+        });
+        connect(m_calendar, &Calendar::entriesUpdated, this, &CalendarSearchModel::update);
+        connect(m_calendar, &QAbstractItemModel::modelReset, this, &CalendarSearchModel::reset);
+    }
+    reset();
+    emit calendarChanged(m_calendar);
+}
+
+void CalendarSearchModel::setQuery(const QString &query)
+{
+    if (m_query != query) {
+        m_query = query;
+        update();
+        emit queryChanged(m_query);
+    }
+}
+
+void CalendarSearchModel::setLimit(int limit)
+{
+    if (m_limit != limit) {
+        m_limit = limit;
+        update();
+        emit limitChanged(m_limit);
+    }
+}
+
+QVector<int> CalendarSearchModel::search() const
+{
+    return m_calendar ? m_calendar->search(m_query, QDateTime::currentSecsSinceEpoch(), m_limit)
+                      : QVector<int> { };
+}
+
+void CalendarSearchModel::reset()
+{
+    beginResetModel();
+    m_rows = search();
+    m_changedRows.clear();
+    endResetModel();
+}
+
+void CalendarSearchModel::update()
+{
+    // both lists are ordered by start time: the difference is applied as removed, inserted and
+    // (if a start time changed) moved rows
+    const QVector<int> rows = search();
+
+    for (qsizetype i = m_rows.size() - 1; i >= 0; ) {
+        if (rows.contains(m_rows.at(i))) {
+            --i;
+            continue;
+        }
+        qsizetype first = i;
+        while ((first > 0) && !rows.contains(m_rows.at(first - 1)))
+            --first;
+
+        beginRemoveRows({ }, int(first), int(i));
+        m_rows.remove(first, i - first + 1);
+        endRemoveRows();
+        i = first - 1;
+    }
+
+    for (qsizetype i = 0; i < rows.size(); ) {
+        if ((i < m_rows.size()) && (m_rows.at(i) == rows.at(i))) {
+            ++i;
+            continue;
+        }
+        const qsizetype from = m_rows.indexOf(rows.at(i), i);
+        if (from >= 0) {
+            beginMoveRows({ }, int(from), int(from), { }, int(i));
+            m_rows.move(from, i);
+            endMoveRows();
+            ++i;
+            continue;
+        }
+        qsizetype last = i;
+        while (((last + 1) < rows.size()) && !m_rows.contains(rows.at(last + 1)))
+            ++last;
+
+        beginInsertRows({ }, int(i), int(last));
+        for (qsizetype n = i; n <= last; ++n)
+            m_rows.insert(n, rows.at(n));
+        endInsertRows();
+        i = last + 1;
+    }
+
+    if (!m_changedRows.isEmpty()) {
+        for (qsizetype i = 0; i < m_rows.size(); ++i) {
+            if (m_changedRows.contains(m_rows.at(i)))
+                emit dataChanged(index(int(i)), index(int(i)));
+        }
+        m_changedRows.clear();
+    }
+}
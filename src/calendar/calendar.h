@@ -7,8 +7,14 @@
 #include <QSortFilterProxyModel>
 #include <QUrl>
 #include <QDateTime>
+#include <QTimeZone>
+#include <QColor>
+#include <QDataStream>
+#include <QSet>
 #include <QFutureWatcher>
 
+#include "icalendarparser.h"
+
 QT_FORWARD_DECLARE_CLASS(QNetworkAccessManager)
 QT_FORWARD_DECLARE_CLASS(QNetworkReply)
 QT_FORWARD_DECLARE_CLASS(QTimer)
@@ -21,8 +27,17 @@ class Calendar : public QAbstractListModel
     Q_PROPERTY(int count READ count NOTIFY countChanged)
 
 public:
+    struct SourceConfiguration
+    {
+        QUrl m_url; // including the credentials
+        QColor m_color;
+        int m_refreshInterval = 0; // sec, 0 means: only on reload()
+        bool m_calDav = false; // RFC 6578 sync-collection instead of a full ICS download
+    };
+
     static Calendar *instance();
-    static Calendar *createInstance(const QUrl &url, QObject *parent = nullptr);
+    static Calendar *createInstance(const QList<SourceConfiguration> &sources, QObject *parent = nullptr);
+    ~Calendar() override;
 
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
     QVariant data(const QModelIndex &index, int role) const override;
@@ -31,46 +46,223 @@ public:
     bool isLoading() const;
     int count() const;
 
-    Q_INVOKABLE void reload();
+    // a forced reload bypasses the HTTP freshness information (e.g. pull-to-refresh)
+    Q_INVOKABLE void reload(bool force = false);
 
     Q_INVOKABLE QVariantMap get(int row) const;
 
+    // number of entries touching each day, starting at from
+    Q_INVOKABLE QList<int> dayDensity(const QDate &from, int days) const;
+    // merged busy intervals (excluding all-day entries and to-dos) as pairs of [start, end)
+    // minute offsets relative to from
+    Q_INVOKABLE QList<int> busyIntervals(const QDateTime &from, const QDateTime &to) const;
+
 protected:
-    void load();
+    void load(bool force = false);
 
 signals:
     void isLoadingChanged(bool isLoading);
     void countChanged();
 
+    // a VALARM of an event or to-do triggered: entry has the same layout as get()
+    void reminderDue(const QVariantMap &entry);
+
+    // all the row changes of a refresh have been applied
+    void entriesUpdated();
+
 private:
-    explicit Calendar(const QUrl &url, QObject *parent = nullptr);
-    void handleNetworkReply(QNetworkReply *reply);
+    explicit Calendar(const QList<SourceConfiguration> &sources, QObject *parent = nullptr);
+
+    struct Source;
+    void load(Source *source, bool force);
+    void handleNetworkReply(Source *source, QNetworkReply *reply);
+    static QDateTime freshUntil(const QNetworkReply *reply);
+    void finishLoading(Source *source, bool failed = false);
+    void scheduleRefresh(Source *source);
+    void parse(Source *source, const QByteArray &data);
+    void updateLoading();
+
+    void loadCalDav(Source *source);
+    void handleCalDavSyncReply(Source *source, QNetworkReply *reply);
+    void handleCalDavMultiGetReply(Source *source, QNetworkReply *reply, const QString &syncToken);
+    void parseCalDavResources(Source *source);
+
+    struct DavResource
+    {
+        QString m_href;
+        QByteArray m_calendarData;
+        bool m_removed = false;
+    };
+    static QList<DavResource> parseDavMultiStatus(const QByteArray &xml, QString *syncToken);
 
 private:
+    enum EntryFlag : quint8 {
+        AllDayFlag    = 0x01,
+        SameDayFlag   = 0x02,
+        TodoFlag      = 0x04, // a VTODO: start and end are the due date
+        OverrideFlag  = 0x08, // a RECURRENCE-ID instance, replacing the generated occurrence
+        CancelledFlag = 0x10, // a cancelled override: only used while parsing
+    };
+
+    // a single occurrence, as produced by the parser and stored in the disk cache
     struct Entry
     {
+        // source + UID + RECURRENCE-ID: identifies an occurrence across re-fetches
+        int m_source = 0;
+        QString m_uid;
+        qint64 m_recurrenceId = 0; // original start, secs since epoch
+
         QString m_summary;
-        QDateTime m_start;
-        QDateTime m_end;
+        qint64 m_start = 0; // secs since epoch
+        qint64 m_end = 0;   // secs since epoch
+        QTimeZone m_timeZone;
+        quint8 m_flags = 0;
+        QList<qint32> m_alarms; // VALARM triggers, secs relative to m_start
 
-        qint64 m_duration = 0; // sec
-        bool m_allDay = false;
-        bool m_sameDay = false;
+        static bool keyLessThan(const Entry &e1, const Entry &e2);
+
+        // m_source is not serialized: the index might change with the configuration
+        friend QDataStream &operator<<(QDataStream &ds, const Entry &entry)
+        {
+            return ds << entry.m_uid << entry.m_recurrenceId << entry.m_summary << entry.m_start
+                      << entry.m_end << entry.m_timeZone << entry.m_flags << entry.m_alarms;
+        }
+        friend QDataStream &operator>>(QDataStream &ds, Entry &entry)
+        {
+            return ds >> entry.m_uid >> entry.m_recurrenceId >> entry.m_summary >> entry.m_start
+                      >> entry.m_end >> entry.m_timeZone >> entry.m_flags >> entry.m_alarms;
+        }
     };
-    QVector<Entry> m_entries;
-    QUrl m_url;
+
+    // The model's rows, stored as a struct of arrays: sorting and filtering in the proxy models
+    // only touch the contiguous start/end arrays. Strings are interned and time zones are
+    // indexed, so that QString and QDateTime values are only created in data().
+    struct EntryStore
+    {
+        QVector<int> m_source;
+        QVector<int> m_uid; // index into m_strings
+        QVector<qint64> m_recurrenceId;
+        QVector<int> m_summary; // index into m_strings
+        QVector<qint64> m_start;
+        QVector<qint64> m_end;
+        QVector<quint16> m_zone; // index into m_zones
+        QVector<quint8> m_flags;
+        QVector<QList<qint32>> m_alarms; // empty for most entries, so no allocations
+
+        QStringList m_strings;
+        QHash<QString, int> m_stringIndex;
+        QList<QTimeZone> m_zones;
+
+        qsizetype size() const { return m_start.size(); }
+
+        void insert(qsizetype row, const QVector<Entry> &entries, qsizetype first, qsizetype count);
+        void replace(qsizetype row, const Entry &entry);
+        void remove(qsizetype row, qsizetype count);
+        void compact();
+
+        bool keyLessThan(qsizetype row, const Entry &entry) const;
+        bool keyLessThan(const Entry &entry, qsizetype row) const;
+        bool equals(qsizetype row, const Entry &entry) const;
+
+        QDateTime startDateTime(qsizetype row) const;
+        QDateTime endDateTime(qsizetype row) const;
+        const QString &summary(qsizetype row) const { return m_strings.at(m_summary.at(row)); }
+
+    private:
+        int intern(const QString &s);
+        quint16 zoneIndex(const QTimeZone &tz);
+    };
+
+    static void sortEntries(QVector<Entry> &entries);
+
+    void updateEntries(int source, const QVector<Entry> &newEntries);
+
+    // fingerprint of a raw VEVENT block plus the VTIMEZONEs -> its parsed and expanded entries
+    using ComponentCache = QHash<quint64, QVector<Entry>>;
+
+    struct ParseResult
+    {
+        QVector<Entry> m_entries;
+        ComponentCache m_components;
+    };
+
+    struct Source
+    {
+        int m_index = 0;
+        SourceConfiguration m_config;
+        bool m_isLoading = false;
+        int m_errorCount = 0; // consecutive failures, for the back-off
+        QDateTime m_freshUntil; // according to Cache-Control / Expires
+        QString m_lastETag;
+        QString m_lastModified;
+        QString m_syncToken; // CalDAV only
+        QMap<QString, QByteArray> m_davResources; // CalDAV only: href -> calendar-data
+        ComponentCache m_componentCache;
+        QFutureWatcher<ParseResult> m_parserWatcher;
+        QTimer *m_refreshTimer = nullptr;
+    };
+
+    // sorted by Entry::keyLessThan, so every source owns one contiguous range of rows
+    EntryStore m_store;
+
+    // rows ordered by start time, plus the running maximum of their end times: all entries
+    // overlapping a range can be found with two binary searches. Rebuilt lazily.
+    struct IntervalIndex
+    {
+        QVector<int> m_rows;
+        QVector<qint64> m_starts;
+        QVector<qint64> m_maxEnds;
+        bool m_dirty = true;
+    };
+    mutable IntervalIndex m_intervalIndex;
+
+    QVector<int> overlappingRows(qint64 from, qint64 to) const;
+
+    // lower-case summary word -> UID -> number of occurrences, kept up to date by updateEntries()
+    QMap<QString, QHash<QString, int>> m_searchIndex;
+
+    static QStringList searchTokens(const QString &text);
+    void updateSearchIndex(qsizetype row, int delta);
+    QVector<int> search(const QString &query, qint64 from, int limit) const;
+    QList<Source *> m_sources;
     QNetworkAccessManager *m_nam;
     bool m_isLoading = false;
     bool m_disabled = false;
-    QString m_lastETag;
 
-    QFutureWatcher<QVector<Entry>> m_parserWatcher;
+    // all upcoming VALARM triggers as a min-heap, rebuilt on every model update
+    struct Reminder
+    {
+        qint64 m_time; // secs since epoch
+        int m_row;
+
+        bool operator>(const Reminder &other) const { return m_time > other.m_time; }
+    };
+    QVector<Reminder> m_reminders;
+    QTimer *m_reminderTimer;
+    qint64 m_remindersFiredUntil; // secs since epoch
+
+    void updateReminders();
+    void scheduleReminderTimer();
+    void fireReminders();
+
+    static QString cacheFileName(const SourceConfiguration &config);
+    void loadCache(Source *source);
+    void saveCache(const Source *source) const;
 
-    QVector<Entry> parseNetworkReply(const QByteArray &data);
+    static quint64 fingerprint(QByteArrayView data);
+    static quint64 combineFingerprints(quint64 fp1, quint64 fp2);
+    static ParseResult parseNetworkReply(int source, const QByteArray &data, const ComponentCache &componentCache);
+    static QVector<Entry> parseComponent(int source, const QByteArray &data,
+                                         const ICalendarParser::TimeZones &timeZones = { });
+    static void appendEpochSecs(QVector<qint64> &list, const QVariant &value);
+    static QVector<qint64> mergeOccurrences(const QVector<qint64> &generated, QVector<qint64> extra,
+                                            QVector<qint64> exceptions);
 
     static Calendar *s_instance;
 
     friend class UpcomingCalendarEntries;
+    friend class CalendarSearchModel;
+    friend class CalendarBenchmark; // benchmarks/calendar
 };
 
 class UpcomingCalendarEntries : public QSortFilterProxyModel
@@ -111,4 +303,50 @@ private:
     Calendar *m_calendar = nullptr;
     QDateTime m_from;
     QDateTime m_to;
+    qint64 m_fromSecs = 0;
+    qint64 m_toSecs = 0;
+};
+
+class CalendarSearchModel : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(Calendar *calendar READ calendar WRITE setCalendar NOTIFY calendarChanged)
+    Q_PROPERTY(QString query READ query WRITE setQuery NOTIFY queryChanged)
+    Q_PROPERTY(int limit READ limit WRITE setLimit NOTIFY limitChanged)
+    Q_PROPERTY(int count READ rowCount NOTIFY countChanged)
+
+public:
+    CalendarSearchModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    Calendar *calendar() const;
+    QString query() const;
+    int limit() const;
+
+    Q_INVOKABLE QVariantMap get(int row) const;
+
+public slots:
+    void setCalendar(Calendar *calendar);
+    void setQuery(const QString &query);
+    void setLimit(int limit);
+
+signals:
+    void calendarChanged(Calendar *calendar);
+    void queryChanged(const QString &query);
+    void limitChanged(int limit);
+    void countChanged();
+
+private:
+    QVector<int> search() const;
+    void reset();
+    void update();
+
+    Calendar *m_calendar = nullptr;
+    QString m_query;
+    int m_limit = 20;
+    QVector<int> m_rows; // upcoming matches in the calendar, ordered by start time (-1: removed)
+    QSet<int> m_changedRows; // calendar rows with changed data, until the next update()
 };
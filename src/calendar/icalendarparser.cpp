@@ -8,6 +8,7 @@
 #include <QTime>
 #include <QTimeZone>
 #include <QRegularExpression>
+#include <QReadWriteLock>
 #include <QDebug>
 
 #include "exception.h"
@@ -222,6 +223,16 @@ QList<ICalendarParser::ContentLine> ICalendarParser::result() const
     return m_result;
 }
 
+void ICalendarParser::setTimeZones(const TimeZones &timeZones)
+{
+    m_timeZones = timeZones;
+}
+
+ICalendarParser::TimeZones ICalendarParser::timeZones() const
+{
+    return m_timeZones;
+}
+
 void ICalendarParser::parseLine(const QByteArray &line)
 {
     if (line.isEmpty())
@@ -237,6 +248,7 @@ void ICalendarParser::parseLine(const QByteArray &line)
         parseValue();
 
         m_result << ContentLine { m_propertyName.toUpper(), m_parameters, m_propertyValue };
+        handleTimeZoneComponent(m_result.constLast());
     } catch (const std::exception &e) {
         QByteArray cause = e.what();
         if (!cause.contains("0329T02")) // ignore warning for un-parseable DST start dates
@@ -373,8 +385,13 @@ void ICalendarParser::parseValue()
             { u"DTSTART"_qs, u"DATE-TIME"_qs },
             { u"DTEND"_qs,   u"DATE-TIME"_qs },
             { u"DTSTAMP"_qs, u"DATE-TIME"_qs },
+            { u"DUE"_qs,     u"DATE-TIME"_qs },
+            { u"COMPLETED"_qs, u"DATE-TIME"_qs },
+            { u"DURATION"_qs, u"DURATION"_qs },
+            { u"TRIGGER"_qs, u"DURATION"_qs },
             { u"RRULE"_qs,   u"RECUR"_qs },
             { u"RDATE"_qs,   u"DATE-TIME-LIST"_qs },
+            { u"RECURRENCE-ID"_qs, u"DATE-TIME"_qs },
             { u"EXDATE"_qs,  u"DATE-TIME-LIST"_qs }
         };
         valueType = defaultTypes.value(m_propertyName);
@@ -447,6 +464,8 @@ void ICalendarParser::parseValue()
         }
     } else if (valueType == u"RECUR") {
         m_propertyValue.setValue(parseRecurrence(value, tzId));
+    } else if (valueType == u"DURATION") {
+        m_propertyValue = parseDuration(value);
     } else {
         m_propertyValue = value;
     }
@@ -454,21 +473,90 @@ void ICalendarParser::parseValue()
     //qWarning() << "PARAMETER VALUE" << m_propertyValue.toString();
 
     // UNHANDLED:
-                     // "DURATION" -- comma speparated -> QList<int>
-//    WEEK: xW
-//    DAY:  xD || xD TIME
-//    TIME: HOUR || MIN || SEC
-//    HOUR: xH || xH MIN
-//    MIN:  xM || xM SEC
-//    SEC:  xS
-
                      // "PERIOD"
     // "RECUR"
 }
 
+namespace {
+
+// DATE and DATE-TIME values have a fixed format: yyyyMMdd, yyyyMMdd'T'HHmmss and
+// yyyyMMdd'T'HHmmss'Z'. Decoding them by hand is a lot faster than going through the generic
+// format string machinery of QDate/QDateTime::fromString().
+struct FixedDateTime
+{
+    int m_year = 0;
+    int m_month = 0;
+    int m_day = 0;
+    int m_hour = 0;
+    int m_minute = 0;
+    int m_second = 0;
+    bool m_hasTime = false;
+    bool m_utc = false;
+};
+
+std::optional<FixedDateTime> decodeFixedDateTime(QStringView s)
+{
+    const auto len = s.size();
+    if ((len != 8) && (len != 15) && (len != 16))
+        return { };
+    if ((len >= 15) && (s[8] != u'T'))
+        return { };
+    if ((len == 16) && (s[15] != u'Z'))
+        return { };
+
+    // validate all the digits in one go without any early exits, so the compiler can
+    // vectorize this loop
+    const int count = (len == 8) ? 8 : 14;
+    int d[14] = { };
+    unsigned invalid = 0;
+    for (int i = 0; i < count; ++i) {
+        const unsigned digit = unsigned(s[i + (i >= 8 ? 1 : 0)].unicode()) - unsigned(u'0');
+        invalid |= unsigned(digit > 9);
+        d[i] = int(digit);
+    }
+    if (invalid)
+        return { };
+
+    FixedDateTime fdt;
+    fdt.m_year = d[0] * 1000 + d[1] * 100 + d[2] * 10 + d[3];
+    fdt.m_month = d[4] * 10 + d[5];
+    fdt.m_day = d[6] * 10 + d[7];
+    fdt.m_hasTime = (count == 14);
+    fdt.m_utc = (len == 16);
+    if (fdt.m_hasTime) {
+        fdt.m_hour = d[8] * 10 + d[9];
+        fdt.m_minute = d[10] * 10 + d[11];
+        fdt.m_second = qMin(d[12] * 10 + d[13], 59); // leap seconds
+    }
+    if ((fdt.m_month < 1) || (fdt.m_month > 12) || (fdt.m_day < 1) || (fdt.m_day > 31)
+            || (fdt.m_hour > 23) || (fdt.m_minute > 59)) {
+        return { };
+    }
+    return fdt;
+}
+
+// days since 1970-01-01 in the proleptic Gregorian calendar (H. Hinnant's algorithm)
+constexpr qint64 daysFromCivil(int y, int m, int d)
+{
+    y -= (m <= 2) ? 1 : 0;
+    const qint64 era = (y >= 0 ? y : y - 399) / 400;
+    const int yoe = int(y - era * 400);
+    const int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static_assert(daysFromCivil(1970, 1, 1) == 0);
+static_assert(daysFromCivil(2000, 3, 1) == 11017);
+
+} // namespace
+
 QDate ICalendarParser::parseDate(const QString &dateString)
 {
-    auto d = QDate::fromString(dateString, u"yyyyMMdd"_qs);
+    auto fdt = decodeFixedDateTime(dateString);
+    QDate d;
+    if (fdt && !fdt->m_hasTime)
+        d = QDate(fdt->m_year, fdt->m_month, fdt->m_day);
     if (!d.isValid())
         throw createException("invalid date specification");
     return d;
@@ -486,6 +574,205 @@ QList<QDate> ICalendarParser::parseDateList(const QString &dateString)
     return dates;
 }
 
+namespace {
+
+// TZID -> QTimeZone, shared by all parsers in all threads. Negative results are cached as
+// invalid QTimeZones. Only the names known to the system's tz database end up in here: the
+// meaning of a VTIMEZONE's TZID is local to its calendar, but its DST rule is not, so the
+// matches for those rules are cached separately.
+struct TimeZoneCache
+{
+    QReadWriteLock m_lock;
+    QHash<QString, QTimeZone> m_zones;
+    QHash<QString, QTimeZone> m_rules;
+};
+
+} // namespace
+
+Q_GLOBAL_STATIC(TimeZoneCache, timeZoneCache)
+
+QTimeZone ICalendarParser::resolveTimeZone(const QString &tzId)
+{
+    auto *cache = timeZoneCache();
+    {
+        QReadLocker locker(&cache->m_lock);
+        auto it = cache->m_zones.constFind(tzId);
+        if (it != cache->m_zones.cend())
+            return *it;
+    }
+
+    QTimeZone tz = lookupTimeZone(tzId);
+
+    // another thread might have resolved it in the meantime
+    QWriteLocker locker(&cache->m_lock);
+    return *cache->m_zones.insert(tzId, tz);
+}
+
+QTimeZone ICalendarParser::lookupTimeZone(const QString &tzId)
+{
+    // this is expensive, so only call it via resolveTimeZone()
+
+    QTimeZone tz = QTimeZone(tzId.toLatin1());
+    if (!tz.isValid()) {
+        QByteArray winTzId = QTimeZone::windowsIdToDefaultIanaId(tzId.toLatin1());
+        if (!winTzId.isEmpty())
+            tz = QTimeZone(winTzId);
+    }
+    if (!tz.isValid() && tzId.startsWith(u"(UTC")) {
+        static const QRegularExpression re(u"^\\(UTC([+-])(\\d\\d):(\\d\\d)\\)$"_qs);
+        auto match = re.match(tzId.left(11));
+        if (match.hasMatch()) {
+            int sign = (match.captured(1) == u"+") ? 1 : -1;
+            int hh = match.captured(2).toInt();
+            int mm = match.captured(3).toInt();
+            tz = QTimeZone(sign * 60 * (hh * 60 + mm));
+        }
+    }
+    if (!tz.isValid()) {
+        static const QHash<QByteArray, QTimeZone> windowsTzCache = []() {
+            QHash<QByteArray, QTimeZone> cache;
+            for (const auto &[offset, name] : windowsTzNames) {
+                auto time = QTime::fromString(QString::fromLatin1(offset + 1), u"hh:mm"_qs);
+                int offsetSec = time.msecsSinceStartOfDay() / 1000;
+                if (*offset == '-')
+                    offsetSec = -offsetSec;
+                cache.insert(QByteArray(name), QTimeZone(offsetSec));
+            }
+            return cache;
+        }();
+        tz = windowsTzCache.value(tzId.toLatin1());
+    }
+    return tz;
+}
+
+QTimeZone ICalendarParser::matchTimeZone(int standardOffset, int standardMonth, int daylightOffset,
+                                         int daylightMonth)
+{
+    // QTimeZone has no public API to create zones with custom DST rules, so we look for a zone
+    // in the system's tz database that switches between the same offsets in the same months.
+    // Only this year's transitions are compared, as that is what the calendar is showing.
+
+    const QString rule = u"%1/%2/%3/%4"_qs.arg(standardOffset).arg(standardMonth)
+            .arg(daylightOffset).arg(daylightMonth);
+
+    auto *cache = timeZoneCache();
+    {
+        QReadLocker locker(&cache->m_lock);
+        auto it = cache->m_rules.constFind(rule);
+        if (it != cache->m_rules.cend())
+            return *it;
+    }
+
+    const int year = QDate::currentDate().year();
+    const QDateTime from(QDate(year, 1, 1), QTime(0, 0), QTimeZone::UTC);
+    const QDateTime to(QDate(year + 1, 1, 1), QTime(0, 0), QTimeZone::UTC);
+
+    QTimeZone tz;
+    const auto ianaIds = QTimeZone::availableTimeZoneIds(standardOffset);
+    for (const auto &ianaId : ianaIds) {
+        QTimeZone candidate(ianaId);
+        if (!candidate.hasTransitions())
+            continue;
+
+        bool toDaylight = false;
+        bool toStandard = false;
+        const auto transitions = candidate.transitions(from, to);
+        for (const auto &transition : transitions) {
+            // the month of the local wall time, just like in the VTIMEZONE
+            const int month = transition.atUtc.addSecs(transition.offsetFromUtc).date().month();
+
+            if ((transition.offsetFromUtc == daylightOffset) && (!daylightMonth || (month == daylightMonth)))
+                toDaylight = true;
+            else if ((transition.offsetFromUtc == standardOffset) && (!standardMonth || (month == standardMonth)))
+                toStandard = true;
+        }
+        if (toDaylight && toStandard) {
+            tz = candidate;
+            break;
+        }
+    }
+
+    QWriteLocker locker(&cache->m_lock);
+    return *cache->m_rules.insert(rule, tz);
+}
+
+void ICalendarParser::handleTimeZoneComponent(const ContentLine &line)
+{
+    // Collect the VTIMEZONE definitions, so that we can resolve TZIDs that are unknown to the
+    // system's tz database (e.g. custom names in Exchange exports)
+
+    if ((line.name == u"BEGIN") && (line.value.toString() == u"VTIMEZONE")) {
+        m_timeZone.emplace();
+        return;
+    } else if (!m_timeZone) {
+        return;
+    }
+
+    if (line.name == u"BEGIN") {
+        m_timeZone->m_component = line.value.toString();
+    } else if ((line.name == u"END") && (line.value.toString() == u"VTIMEZONE")) {
+        const auto &def = *m_timeZone;
+
+        // the system's tz database has better data than a VTIMEZONE, so only fill the gaps
+        if (!def.m_tzId.isEmpty() && !m_timeZones.contains(def.m_tzId)
+                && !resolveTimeZone(def.m_tzId).isValid()) {
+            QTimeZone tz;
+            if (!def.m_location.isEmpty())
+                tz = resolveTimeZone(def.m_location);
+
+            if (!tz.isValid() && def.m_standardOffset && def.m_daylightOffset) {
+                tz = matchTimeZone(*def.m_standardOffset, def.m_standardMonth,
+                                   *def.m_daylightOffset, def.m_daylightMonth);
+            } else if (!tz.isValid() && (def.m_standardOffset || def.m_daylightOffset)) {
+                // without DST, a fixed offset zone is exact
+                tz = QTimeZone(def.m_standardOffset ? *def.m_standardOffset : *def.m_daylightOffset);
+            }
+
+            if (tz.isValid())
+                m_timeZones.insert(def.m_tzId, tz);
+            else
+                qDebug().noquote() << "No matching time zone for VTIMEZONE" << def.m_tzId;
+        }
+        m_timeZone.reset();
+    } else if (line.name == u"END") {
+        m_timeZone->m_component.clear();
+    } else if (m_timeZone->m_component.isEmpty()) {
+        if (line.name == u"TZID")
+            m_timeZone->m_tzId = line.value.toString();
+        else if (line.name == u"X-LIC-LOCATION")
+            m_timeZone->m_location = line.value.toString();
+    } else if (line.name == u"TZOFFSETTO") {
+        static const QRegularExpression re(u"^([+-])(\\d\\d)(\\d\\d)(\\d\\d)?$"_qs);
+        auto match = re.match(line.value.toString());
+        if (match.hasMatch()) {
+            int offsetSec = match.captured(2).toInt() * 60 * 60 + match.captured(3).toInt() * 60
+                    + match.captured(4).toInt();
+            if (match.captured(1) == u"-")
+                offsetSec = -offsetSec;
+
+            if (m_timeZone->m_component == u"STANDARD")
+                m_timeZone->m_standardOffset = offsetSec;
+            else if (m_timeZone->m_component == u"DAYLIGHT")
+                m_timeZone->m_daylightOffset = offsetSec;
+        }
+    } else if ((line.name == u"DTSTART") || (line.name == u"RRULE")) {
+        // ICalendarRecurrence has no BYMONTH, so this has to come from the raw line. Without
+        // one, the DTSTART is the (only) transition.
+        int month = 0;
+        if (line.name == u"RRULE") {
+            static const QRegularExpression re(u"[:;]BYMONTH=(\\d+)"_qs);
+            month = re.match(m_line).captured(1).toInt();
+        }
+
+        int &transitionMonth = (m_timeZone->m_component == u"DAYLIGHT") ? m_timeZone->m_daylightMonth
+                                                                         : m_timeZone->m_standardMonth;
+        if (month)
+            transitionMonth = month;
+        else if (!transitionMonth && (line.name == u"DTSTART"))
+            transitionMonth = line.value.toDateTime().date().month();
+    }
+}
+
 QDateTime ICalendarParser::parseDateTime(const QString &dtString, const QString &tzId)
 {
     // please note: the returned QDateTime could be invalid when interpreted in the wrong (read:
@@ -494,65 +781,38 @@ QDateTime ICalendarParser::parseDateTime(const QString &dtString, const QString
 
     QTimeZone tz;
     if (!tzId.isEmpty()) {
-        tz = QTimeZone(tzId.toLatin1());
-        if (!tz.isValid()) {
-            QByteArray winTzId = QTimeZone::windowsIdToDefaultIanaId(tzId.toLatin1());
-            if (!winTzId.isEmpty())
-                tz = QTimeZone(winTzId);
-        }
-        if (!tz.isValid() && tzId.startsWith(u"(UTC")) {
-            static const QRegularExpression re(u"^\\(UTC([+-])(\\d\\d):(\\d\\d)\\)$"_qs);
-            auto match = re.match(tzId.left(11));
-            if (match.hasMatch()) {
-                int sign = (match.captured(1) == u"+") ? 1 : -1;
-                int hh = match.captured(2).toInt();
-                int mm = match.captured(3).toInt();
-                tz = QTimeZone(sign * 60 * (hh * 60 + mm));
-            }
-        }
-        if (!tz.isValid()) {
-            static QHash<QByteArray, QTimeZone> windowsTzCache;
-            if (windowsTzCache.isEmpty()) {
-                for (const auto &[offset, name] : windowsTzNames) {
-                    auto time = QTime::fromString(QString::fromLatin1(offset + 1), u"hh:mm"_qs);
-                    int offsetSec = time.msecsSinceStartOfDay() / 1000;
-                    if (*offset == '-')
-                        offsetSec = -offsetSec;
-                    windowsTzCache.insert(QByteArray(name), QTimeZone(offsetSec));
-                }
-            }
-            tz = windowsTzCache.value(tzId.toLatin1());
-        }
+        tz = resolveTimeZone(tzId);
+        if (!tz.isValid())
+            tz = m_timeZones.value(tzId);
 
         if (!tz.isValid())
             throw createException("unknown timezone");
     }
 
+    auto fdt = decodeFixedDateTime(dtString);
+    if (!fdt || !QDate::isValid(fdt->m_year, fdt->m_month, fdt->m_day))
+        throw createException("invalid date-time specification");
+
     QDateTime dt;
-    if (dtString.endsWith(u"Z")) {
+    if (!fdt->m_hasTime) {
+        // a date instead of a date-time
+        dt = QDateTime(QDate(fdt->m_year, fdt->m_month, fdt->m_day), QTime(0, 0));
+    } else if (fdt->m_utc) {
         if (tz.isValid())
             throw createException("cannot have TZID and 'Z' UTC designator at the same time");
 
-        dt = QDateTime::fromString(dtString, u"yyyyMMdd'T'HHmmss'Z'"_qs);
-        dt.setTimeSpec(Qt::UTC);
+        // no need for any timezone lookups: we can directly calculate the epoch seconds
+        const qint64 secs = daysFromCivil(fdt->m_year, fdt->m_month, fdt->m_day) * 86400
+                + fdt->m_hour * 3600 + fdt->m_minute * 60 + fdt->m_second;
+        dt = QDateTime::fromSecsSinceEpoch(secs, QTimeZone::UTC);
     } else {
-        dt = QDateTime::fromString(dtString, u"yyyyMMdd'T'HHmmss"_qs);
-        if (tz.isValid()) {
-            //dt.setTimeSpec(Qt::TimeZone);
-            dt.setTimeZone(tz);
-        }
-    }
-    if (!dt.isValid()) {
-        // let's see if it was a parse error, or if we are just in the wrong time zone
-        dt.setTimeSpec(Qt::UTC);
-        if (!dt.isValid()) {
-            // try to parse it as a date instead:
-            try {
-                dt = QDateTime(parseDate(dtString), QTime(0, 0));
-            } catch (...) {
-                throw createException("invalid date-time specification");
-            }
-        }
+        const QDate date(fdt->m_year, fdt->m_month, fdt->m_day);
+        const QTime time(fdt->m_hour, fdt->m_minute, fdt->m_second);
+        dt = tz.isValid() ? QDateTime(date, time, tz) : QDateTime(date, time);
+
+        // we are in the wrong time zone (e.g. inside a DST gap): just use the plain values
+        if (!dt.isValid())
+            dt = QDateTime(date, time, QTimeZone::UTC);
     }
     //qDebug() << "Parse DateTime:" << dtString << "in TZ:" << tzId << "yields:" << dt;
     return dt;
@@ -616,6 +876,54 @@ ICalendarRecurrence ICalendarParser::parseRecurrence(const QString &value, const
     return rrule;
 }
 
+qint64 ICalendarParser::parseDuration(const QString &value)
+{
+    // [+-]P(nW | nD | [nD]T[nH][nM][nS]) -> seconds
+    qsizetype pos = 0;
+    bool negative = false;
+    if ((pos < value.size()) && ((value[pos] == u'+') || (value[pos] == u'-')))
+        negative = (value[pos++] == u'-');
+    if ((pos >= value.size()) || (value[pos++] != u'P'))
+        throw createException("invalid duration");
+
+    qint64 secs = 0;
+    bool inTime = false;
+    bool hasValue = false;
+    qint64 number = -1;
+
+    for (; pos < value.size(); ++pos) {
+        const QChar c = value[pos];
+        if (c.isDigit()) {
+            number = qMax<qint64>(number, 0) * 10 + c.digitValue();
+            continue;
+        } else if ((c == u'T') && !inTime && (number < 0)) {
+            inTime = true;
+            continue;
+        } else if (number < 0) {
+            break;
+        }
+
+        if (!inTime && (c == u'W'))
+            secs += number * 7 * 24 * 60 * 60;
+        else if (!inTime && (c == u'D'))
+            secs += number * 24 * 60 * 60;
+        else if (inTime && (c == u'H'))
+            secs += number * 60 * 60;
+        else if (inTime && (c == u'M'))
+            secs += number * 60;
+        else if (inTime && (c == u'S'))
+            secs += number;
+        else
+            break;
+        number = -1;
+        hasValue = true;
+    }
+    if (!hasValue || (pos < value.size()) || (number >= 0))
+        throw createException("invalid duration");
+
+    return negative ? -secs : secs;
+}
+
 Exception ICalendarParser::createException(const char *message) const
 {
     QString msg = u"Error while parsing:\n"_qs + m_line + u"\n"_qs;
@@ -2,12 +2,16 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
 #include <QByteArray>
+#include <QHash>
 #include <QList>
 #include <QPair>
 #include <QString>
 #include <QStringList>
 #include <QVariant>
 #include <QDateTime>
+#include <QTimeZone>
+
+#include <optional>
 
 #include "exception.h"
 
@@ -47,6 +51,15 @@ public:
 
     QList<ContentLine> result() const;
 
+    // TZID -> zone for the VTIMEZONE definitions that the system's tz database doesn't know.
+    // These are only valid for the calendar they were defined in.
+    using TimeZones = QHash<QString, QTimeZone>;
+    void setTimeZones(const TimeZones &timeZones);
+    TimeZones timeZones() const;
+
+    // process-wide and thread-safe TZID resolution cache
+    static QTimeZone resolveTimeZone(const QString &tzId);
+
 private:
     void parseLine(const QByteArray &line);
     void parseName();
@@ -62,6 +75,12 @@ private:
     QList<QDateTime> parseDateTimeList(const QString &dateTimeString, const QString &tzId);
     QString firstParameterValue(const QString &parameterName);
     ICalendarRecurrence parseRecurrence(const QString &value, const QString &tzId);
+    qint64 parseDuration(const QString &value);
+
+    static QTimeZone lookupTimeZone(const QString &tzId);
+    static QTimeZone matchTimeZone(int standardOffset, int standardMonth, int daylightOffset,
+                                   int daylightMonth);
+    void handleTimeZoneComponent(const ContentLine &line);
 
     Exception createException(const char *message) const;
 
@@ -81,4 +100,17 @@ private:
     bool m_valueAsBase64;
 
     QList<ContentLine> m_result;
+    TimeZones m_timeZones;
+
+    struct TimeZoneDefinition
+    {
+        QString m_tzId;
+        QString m_location;
+        QString m_component; // STANDARD or DAYLIGHT
+        std::optional<int> m_standardOffset;
+        std::optional<int> m_daylightOffset;
+        int m_standardMonth = 0; // of the transition, from BYMONTH or DTSTART
+        int m_daylightMonth = 0;
+    };
+    std::optional<TimeZoneDefinition> m_timeZone; // inside a VTIMEZONE
 };
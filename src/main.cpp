@@ -36,6 +36,7 @@
 #include "homeassistant/homeassistant.h"
 #include "screenbrightness/screenbrightness.h"
 #include "squeezebox/squeezeboxserver.h"
+#include "squeezebox/squeezeboxcoverart.h"
 #include "calendar/calendar.h"
 #include "xbrowsersync/xbrowsersync.h"
 #include "version.h"
@@ -264,6 +265,7 @@ int main(int argc, char *argv[])
     QQmlApplicationEngine engine;
     engine.setOutputWarningsToStandardError(true);
     engine.addImportPath(qmlPath);
+    engine.addImageProvider(u"squeezebox"_qs, new SqueezeBoxCoverArtProvider);
 
     // Qt 6.10+: the engine implicitly searches qrc:/qt-project.org/imports/ for QML modules.
     // When a style plugin (e.g. Universal) is loaded, its transitive dependency on the Basic
@@ -356,12 +358,21 @@ int main(int argc, char *argv[])
         QUrl squeezeBoxServerUrl = QUrl::fromUserInput(squeezeboxServer[u"url"_qs].toString());
         QStringList sbPlayerNames = squeezeboxServer[u"players"_qs].toStringList();
         auto sbThisPlayerName = squeezeboxServer[u"thisPlayer"_qs].toString();
-
-        SqueezeBoxServer::createInstance(squeezeBoxServerUrl.host(), squeezeBoxServerUrl.port());
+        int sbCommandWindow = squeezeboxServer[u"commandWindow"_qs].toInt();
+        bool sbJsonRpc = (squeezeboxServer[u"transport"_qs].toString() == u"jsonrpc");
+        bool sbDiscover = squeezeboxServer[u"discover"_qs].toBool();
+
+        SqueezeBoxServer::createInstance(squeezeBoxServerUrl.host(), squeezeBoxServerUrl.port(sbJsonRpc ? 9000 : 9090));
+        if (sbJsonRpc)
+            SqueezeBoxServer::instance()->setTransport(SqueezeBoxServer::Transport::JsonRpc);
+        if (sbDiscover)
+            SqueezeBoxServer::instance()->setDiscoveryEnabled(true);
         if (!sbPlayerNames.isEmpty())
             SqueezeBoxServer::instance()->setPlayerNameFilter(sbPlayerNames);
         if (!sbThisPlayerName.isEmpty())
             SqueezeBoxServer::instance()->setThisPlayerName(sbThisPlayerName);
+        if (sbCommandWindow > 0)
+            SqueezeBoxServer::instance()->setCommandWindowSize(sbCommandWindow);
 
         /////////////////////////////////
 
@@ -385,12 +396,26 @@ int main(int argc, char *argv[])
 
         /////////////////////////////////
 
-        const auto calendar = config["calendar"].toMap();
-        QUrl calUrl = QUrl::fromUserInput(calendar[u"url"_qs].toString());
-        calUrl.setUserName(calendar[u"username"_qs].toString());
-        calUrl.setPassword(calendar[u"password"_qs].toString());
-
-        Calendar::createInstance(calUrl, qApp);
+        // either a single calendar, or a list of calendars
+        const auto calendarConfig = config["calendar"];
+        const QVariantList calendars = (calendarConfig.typeId() == QMetaType::QVariantList)
+                ? calendarConfig.toList() : QVariantList { calendarConfig };
+        QList<Calendar::SourceConfiguration> calSources;
+
+        for (const auto &calendarValue : calendars) {
+            const auto calendar = calendarValue.toMap();
+            if (calendar.isEmpty())
+                continue;
+            QUrl calUrl = QUrl::fromUserInput(calendar[u"url"_qs].toString());
+            calUrl.setUserName(calendar[u"username"_qs].toString());
+            calUrl.setPassword(calendar[u"password"_qs].toString());
+            QColor calColor = QColor::fromString(calendar[u"color"_qs].toString());
+            int calRefresh = calendar[u"refreshInterval"_qs].toInt();
+            bool calDav = calendar[u"caldav"_qs].toBool();
+
+            calSources.append({ calUrl, calColor, calRefresh, calDav });
+        }
+        Calendar::createInstance(calSources, qApp);
 
         /////////////////////////////////
 
@@ -28,7 +28,7 @@ Control {
         ScrollIndicator.vertical: ScrollIndicator { }
 
         PullToRefreshListHeader {
-            onRefresh: upcoming.calendar.reload()
+            onRefresh: upcoming.calendar.reload(true)
         }
 
         Timer {
@@ -340,6 +340,19 @@ ApplicationWindow {
             id: sqb
 
             property string entity: "media_player.buero"
+            // the LMS player id (MAC address) of the entity: HA's unique_id, as shown in the
+            // entity settings. Names are not stable, they can be changed on both sides.
+            property string playerId
+
+            // the server scales the cover art down to the sourceSize and it is cached locally,
+            // instead of loading the full-size entity_picture through HA
+            readonly property SqueezeBoxPlayer sbPlayer: {
+                for (let p of SqueezeBoxServer.players) {
+                    if (p.playerId === sqb.playerId)
+                        return p
+                }
+                return null
+            }
 
             Connections {
                 target: HomeAssistant
@@ -371,9 +384,11 @@ ApplicationWindow {
                 anchors.fill: parent
 
                 Image {
-                    source: playing.coverArtSource
+                    source: sqb.sbPlayer ? sqb.sbPlayer.coverArt : playing.coverArtSource
+                    sourceSize: Qt.size(width, height)
                     fillMode: Image.PreserveAspectFit
                     cache: false
+                    asynchronous: true
                     onStatusChanged: { if (status === Image.Error) source = '' }
 
                     Layout.maximumHeight: playVolume.implicitHeight
@@ -8,12 +8,22 @@ import Ui
 Control {
     id: root
     property string entity
+    property string playerId // LMS id (MAC address) of the entity's player, i.e. HA's unique_id
+
+    // falls back to HA's full-size entity_picture, if LMS doesn't know this player
+    readonly property SqueezeBoxPlayer _player: {
+        for (let p of SqueezeBoxServer.players) {
+            if (p.playerId === root.playerId)
+                return p
+        }
+        return null
+    }
 
     property string _currentPlaylistName
     property string _currentTitle
     property string _currentArtist
     property string _currentAlbum
-    property url _coverArt
+    property url _haCoverArt
     property bool _playing: false
     property bool _muted: false
     property real volume: 0
@@ -26,7 +36,7 @@ Control {
             _currentTitle = attributes.media_title || ''
             _currentArtist = attributes.media_artist || ''
             _currentAlbum = attributes.media_album_name || ''
-            _coverArt = attributes.entity_picture ? HomeAssistant.baseUrl + attributes.entity_picture : ''
+            _haCoverArt = attributes.entity_picture ? HomeAssistant.baseUrl + attributes.entity_picture : ''
             volume = attributes.volume_level || 0
         })
     }
@@ -40,7 +50,7 @@ Control {
         opacity: root._playing ? 0.5 : 0
         clip: true
 
-        property url source: root._coverArt
+        property url source: root._player ? root._player.coverArt : root._haCoverArt
 
         property var _images: [ covertArtLeft, covertArtRight ]
 
@@ -78,12 +88,14 @@ Control {
             id: covertArtLeft
             cache: false
             fillMode: Image.PreserveAspectFit
+            sourceSize: Qt.size(coverArt.width, coverArt.height)
             onStatusChanged: { if (status === Image.Error) source = '' }
         }
         Image {
             id: covertArtRight
             cache: false
             fillMode: Image.PreserveAspectFit
+            sourceSize: Qt.size(coverArt.width, coverArt.height)
             onStatusChanged: { if (status === Image.Error) source = '' }
         }
     }
@@ -189,7 +201,7 @@ Control {
         SqueezeBoxVolume {
             id: volumeDialog
             entities: [
-                { "entity": root.entity,               "name": "Küche",     "master": true },
+                { "entity": root.entity,               "name": "Küche",     "master": true, "playerId": root.playerId },
                 { "entity": "media_player.wohnzimmer", "name": "Wohnzimmer" },
                 { "entity": "media_player.terrasse",   "name": "Terrasse" },
                 { "entity": "media_player.keller",     "name": "Waschküche" }
@@ -39,7 +39,9 @@ Popup {
             property string name
             property bool master
             property string entity
-            property int volume
+            property string playerId // optional: LMS id (MAC address) of the entity's player
+            readonly property int volume: player ? player.volume : haVolume
+            property int haVolume
             property bool muted
             property bool power
             property bool synced
@@ -68,13 +70,26 @@ Popup {
                 synced = !synced
             }
 
+            // if LMS knows this player, the volume is set directly: a dragged slider then results
+            // in one command per round-trip instead of a service call for every single step
+            readonly property SqueezeBoxPlayer player: {
+                for (let p of SqueezeBoxServer.players) {
+                    if (p.playerId === item.playerId)
+                        return p
+                }
+                return null
+            }
+
             function setVolume(newVolume) {
-                HomeAssistant.callService('media_player.volume_set', entity, { volume_level: newVolume / 100 })
+                if (player)
+                    player.volume = newVolume
+                else
+                    HomeAssistant.callService('media_player.volume_set', entity, { volume_level: newVolume / 100 })
             }
 
             Component.onCompleted: {
                 HomeAssistant.subscribe(entity, function(state, attributes) {
-                    volume = 100 * (attributes.volume_level || 0)
+                    haVolume = 100 * (attributes.volume_level || 0)
                     muted = attributes.is_volume_muted || false
                     power = (state !== 'off')
                     synced = attributes.sync_group.length > 0
@@ -90,6 +105,7 @@ Popup {
                                                     {
                                                         "index": i,
                                                         "entity": entities[i].entity,
+                                                        "playerId": entities[i].playerId || '',
                                                         "name": entities[i].name,
                                                         "master": entities[i].master || false
                                                     })
@@ -73,6 +73,13 @@ class ForeignUpcomingCalendarEntries
     QML_NAMED_ELEMENT(UpcomingCalendarEntries)
 };
 
+class ForeignCalendarSearchModel
+{
+    Q_GADGET
+    QML_FOREIGN(CalendarSearchModel)
+    QML_NAMED_ELEMENT(CalendarSearchModel)
+};
+
 class ForeignSqueezeBoxServer
 {
     Q_GADGET
@@ -95,6 +102,14 @@ class ForeignSqueezeBoxPlayer
     QML_UNCREATABLE("")
 };
 
+class ForeignSqueezeBoxPlaylistModel
+{
+    Q_GADGET
+    QML_FOREIGN(SqueezeBoxPlaylistModel)
+    QML_NAMED_ELEMENT(SqueezeBoxPlaylistModel)
+    QML_UNCREATABLE("")
+};
+
 class ForeignListOfSqueezeBoxPlayer
 {
     Q_GADGET
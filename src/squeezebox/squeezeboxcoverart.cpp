@@ -0,0 +1,178 @@
+// Copyright (C) 2017-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <QNetworkAccessManager>
+#include <QNetworkDiskCache>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QStandardPaths>
+#include <QQuickTextureFactory>
+
+#include "squeezeboxcoverart.h"
+#include "squeezeboxserver.h"
+
+
+class SqueezeBoxCoverArtProvider::Response : public QQuickImageResponse
+{
+public:
+    Response(SqueezeBoxCoverArtProvider *provider = nullptr)
+        : m_provider(provider)
+    { }
+
+    ~Response() override
+    {
+        // the image loader may cancel and delete us while the download is still running
+        // (m_provider is only reset by the provider's destructor)
+        if (m_provider)
+            m_provider->unregister(this);
+    }
+
+    QQuickTextureFactory *textureFactory() const override
+    {
+        return m_image.isNull() ? nullptr : QQuickTextureFactory::textureFactoryForImage(m_image);
+    }
+
+    QString errorString() const override
+    {
+        return m_errorString;
+    }
+
+    SqueezeBoxCoverArtProvider *m_provider;
+    QImage m_image;
+    QString m_errorString;
+};
+
+
+SqueezeBoxCoverArtProvider::SqueezeBoxCoverArtProvider(qsizetype memoryCacheSize, qint64 diskCacheSize)
+    : m_images(memoryCacheSize)
+    , m_nam(new QNetworkAccessManager(&m_context))
+{
+    // the cover art of a coverid never changes, so the disk cache never needs revalidating
+    auto *diskCache = new QNetworkDiskCache(m_nam);
+    diskCache->setCacheDirectory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+                                 + u"/squeezebox-coverart"_qs);
+    diskCache->setMaximumCacheSize(diskCacheSize);
+    m_nam->setCache(diskCache);
+
+    m_decodePool.setMaxThreadCount(2);
+}
+
+SqueezeBoxCoverArtProvider::~SqueezeBoxCoverArtProvider()
+{
+    m_decodePool.waitForDone();
+
+    QMutexLocker locker(&m_mutex);
+    for (const auto &responses : std::as_const(m_pending)) {
+        for (auto *response : responses)
+            response->m_provider = nullptr;
+    }
+}
+
+QQuickImageResponse *SqueezeBoxCoverArtProvider::requestImageResponse(const QString &id, const QSize &requestedSize)
+{
+    // only ask for the size that is actually displayed (sourceSize), square if just one
+    // dimension is set
+    QSize size = requestedSize;
+    if (size.width() <= 0)
+        size.setWidth(size.height());
+    if (size.height() <= 0)
+        size.setHeight(size.width());
+    if (size.isEmpty())
+        size = QSize(300, 300);
+
+    const QString key = id + u'@' + QString::number(size.width()) + u'x' + QString::number(size.height());
+
+    QMutexLocker locker(&m_mutex);
+
+    if (const QImage *image = m_images.object(key)) {
+        auto *response = new Response;
+        response->m_image = *image;
+        // the loader only connects to finished() after we return
+        QMetaObject::invokeMethod(response, [response]() { emit response->finished(); }, Qt::QueuedConnection);
+        return response;
+    }
+
+    auto *response = new Response(this);
+    auto &waiting = m_pending[key];
+    waiting.append(response);
+
+    // the same cover is often requested by multiple items at once: only fetch it once
+    if (waiting.size() == 1) {
+        QMetaObject::invokeMethod(&m_context, [this, id, size, key]() {
+            fetch(id, size, key);
+        }, Qt::QueuedConnection);
+    }
+    return response;
+}
+
+void SqueezeBoxCoverArtProvider::fetch(const QString &coverId, const QSize &size, const QString &key)
+{
+    const auto *server = SqueezeBoxServer::instance();
+    if (!server) {
+        deliver(key, { }, u"No SqueezeBox server configured"_qs);
+        return;
+    }
+
+    QNetworkRequest request(server->coverArtUrl(coverId, size));
+    request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferCache);
+
+    auto *reply = m_nam->get(request);
+    QObject::connect(reply, &QNetworkReply::finished, &m_context, [this, reply, key, size]() {
+        reply->deleteLater();
+
+        if (reply->error() != QNetworkReply::NoError) {
+            deliver(key, { }, reply->errorString());
+            return;
+        }
+        m_decodePool.start([this, key, size, data = reply->readAll()]() {
+            decode(key, data, size);
+        });
+    });
+}
+
+void SqueezeBoxCoverArtProvider::decode(const QString &key, const QByteArray &data, const QSize &size)
+{
+    QImage image = QImage::fromData(data);
+    if (image.isNull()) {
+        deliver(key, { }, u"Could not decode the cover art"_qs);
+        return;
+    }
+
+    // older servers (and some plugins) ignore the size in the URL
+    if ((image.width() > size.width()) || (image.height() > size.height()))
+        image = image.scaled(size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+
+    // the format the scene graph can upload without another conversion
+    deliver(key, image.convertToFormat(QImage::Format_ARGB32_Premultiplied));
+}
+
+void SqueezeBoxCoverArtProvider::deliver(const QString &key, const QImage &image, const QString &errorString)
+{
+    if (!errorString.isEmpty())
+        qWarning() << "Failed to load SqueezeBox cover art" << key << ":" << errorString;
+
+    QMutexLocker locker(&m_mutex);
+
+    if (!image.isNull())
+        m_images.insert(key, new QImage(image), image.sizeInBytes());
+
+    // responses unregister themselves under the same mutex, so all of these are still alive
+    const auto waiting = m_pending.take(key);
+    for (auto *response : waiting) {
+        QMetaObject::invokeMethod(response, [response, image, errorString]() {
+            response->m_image = image;
+            response->m_errorString = errorString;
+            emit response->finished();
+        }, Qt::QueuedConnection);
+    }
+}
+
+void SqueezeBoxCoverArtProvider::unregister(Response *response)
+{
+    QMutexLocker locker(&m_mutex);
+
+    for (auto it = m_pending.begin(); it != m_pending.end(); ++it) {
+        if (it->removeOne(response))
+            break;
+    }
+}
@@ -0,0 +1,45 @@
+// Copyright (C) 2017-2024 Robert Griebl
+// SPDX-License-Identifier: GPL-3.0-only
+
+#pragma once
+
+#include <QQuickAsyncImageProvider>
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QThreadPool>
+
+QT_FORWARD_DECLARE_CLASS(QNetworkAccessManager)
+
+
+// Serves image://squeezebox/<coverid> URLs, as used by SqueezeBoxPlayer::coverArt and the
+// playlist model. The server scales the artwork down to the requested size, the decoding
+// happens on a worker thread and the decoded images are kept in a LRU cache, so switching
+// back and forth between tracks does not cause any network traffic or decoding at all.
+class SqueezeBoxCoverArtProvider : public QQuickAsyncImageProvider
+{
+public:
+    explicit SqueezeBoxCoverArtProvider(qsizetype memoryCacheSize = 48 * 1024 * 1024,
+                                        qint64 diskCacheSize = 64 * 1024 * 1024);
+    ~SqueezeBoxCoverArtProvider() override;
+
+    // called on the QML image loader thread(s)
+    QQuickImageResponse *requestImageResponse(const QString &id, const QSize &requestedSize) override;
+
+private:
+    class Response;
+
+    void fetch(const QString &coverId, const QSize &size, const QString &key);
+    void decode(const QString &key, const QByteArray &data, const QSize &size);
+    void deliver(const QString &key, const QImage &image, const QString &errorString = { });
+    void unregister(Response *response);
+
+    QMutex m_mutex; // protects m_images and m_pending
+    QCache<QString, QImage> m_images; // "coverid@WxH" -> image, the cost is the size in bytes
+    QHash<QString, QList<Response *>> m_pending; // by the same key
+
+    QObject m_context; // lives in the main thread, like m_nam
+    QNetworkAccessManager *m_nam;
+    QThreadPool m_decodePool;
+};
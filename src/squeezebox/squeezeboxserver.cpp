@@ -4,6 +4,7 @@
 #include <QJsonDocument>
 #include <QJsonArray>
 #include <QJsonObject>
+#include <QMetaMethod>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QNetworkRequest>
@@ -11,26 +12,35 @@
 #include <QTcpSocket>
 #include <QTimer>
 #include <QNetworkInterface>
+#include <QNetworkDatagram>
+#include <QUdpSocket>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QFile>
+#include <QDir>
+#include <QStandardPaths>
 
 #include "squeezeboxserver.h"
 
 using namespace std::placeholders;
 
-void SqueezeBoxServer::onPlayersReply(const QStringList &result)
+void SqueezeBoxServer::onPlayersReply(const RawArgs &result)
 {
-    const auto parsed = parseExtendedResult(result, u"playerindex"_qs);
-
-    if (parsed.first.value(u"count"_qs).toInt() != parsed.second.count())
+    QVector<PlayerInfo> sbplayers;
+    if (!decodePlayersReply(result, sbplayers))
         return;
 
-    //qWarning() << parsed.second;
-
     QStringList existingPlayerIds = m_players.keys();
 
-    for (const auto &sbplayer : parsed.second) {
-        const QString id = sbplayer.value(u"playerid"_qs);
-        const QString ip = sbplayer.value(u"ip"_qs).section(u':', 0, -2); // chop off port number
-        const QString name = sbplayer.value(u"name"_qs);
+    m_serverPlayerIds.clear();
+    for (const auto &sbplayer : std::as_const(sbplayers))
+        m_serverPlayerIds << sbplayer.m_id;
+    m_serverPlayerIds.sort();
+
+    for (const auto &sbplayer : std::as_const(sbplayers)) {
+        const QString &id = sbplayer.m_id;
+        const QString &ip = sbplayer.m_ip;
+        const QString &name = sbplayer.m_name;
 
         if (m_nameFilter.isEmpty() || m_nameFilter.contains(name)) {
             auto it = m_players.constFind(id);
@@ -41,48 +51,28 @@ void SqueezeBoxServer::onPlayersReply(const QStringList &result)
                     player->m_name = name;
                     emit player->nameChanged(name);
                 }
+                player->updateStale(false);
                 existingPlayerIds.removeOne(id);
 
-                bool isThisPlayer = (player == m_thisPlayer);
-                bool willBeThisPlayer;
-
-                if (!m_thisPlayerName.isEmpty())
-                    willBeThisPlayer = (m_thisPlayerName == name);
-                else
-                    willBeThisPlayer = m_ipAddresses.contains(ip);
+                bool wasThisPlayer = (player == m_thisPlayer);
+                bool willBeThisPlayer = isThisPlayer(name, ip);
 
                 if (ip != player->m_address)
                     player->m_address = ip;
 
-                if (isThisPlayer != willBeThisPlayer) {
+                if (wasThisPlayer != willBeThisPlayer) {
                     m_thisPlayer = willBeThisPlayer ? player : nullptr;
                     emit thisPlayerChanged();
                 }
             } else {
-                auto player = new SqueezeBoxPlayer();
-                QQmlEngine::setObjectOwnership(player, QQmlEngine::CppOwnership);
-                player->m_playerId = id;
-                player->m_address = ip;
-                player->m_name = name;
-                m_players.insert(id, player);
-                emit playersChanged();
-                emit playerAdded(player);
-
-                if (!m_thisPlayerName.isEmpty()) {
-                    if (name == m_thisPlayerName) {
-                        m_thisPlayer = player;
-                        emit thisPlayerChanged();
-                    }
-                } else if (m_ipAddresses.contains(ip)) {
-                    m_thisPlayer = player;
-                    emit thisPlayerChanged();
-                }
+                addPlayer(id, name, ip);
             }
         }
     }
 
     for (const auto &id : existingPlayerIds) {
         auto player = m_players.take(id);
+        m_rawPlayerIds.remove(QUrl::toPercentEncoding(id));
         emit playerRemoved(player);
         emit playersChanged();
         if (player == m_thisPlayer) {
@@ -91,6 +81,51 @@ void SqueezeBoxServer::onPlayersReply(const QStringList &result)
         }
         delete player;
     }
+
+    saveCache();
+}
+
+SqueezeBoxPlayer *SqueezeBoxServer::addPlayer(const QString &id, const QString &name, const QString &ip)
+{
+    auto player = new SqueezeBoxPlayer(this);
+    QQmlEngine::setObjectOwnership(player, QQmlEngine::CppOwnership);
+    player->m_playerId = id;
+    player->m_address = ip;
+    player->m_name = name;
+    m_players.insert(id, player);
+    m_rawPlayerIds.insert(QUrl::toPercentEncoding(id));
+    emit playersChanged();
+    emit playerAdded(player);
+
+    if (isThisPlayer(name, ip)) {
+        m_thisPlayer = player;
+        emit thisPlayerChanged();
+    }
+    return player;
+}
+
+bool SqueezeBoxServer::isThisPlayer(const QString &name, const QString &ip) const
+{
+    if (!m_thisPlayerName.isEmpty())
+        return (name == m_thisPlayerName);
+    else
+        return m_ipAddresses.contains(ip);
+}
+
+void SqueezeBoxServer::setupPlayer(SqueezeBoxPlayer *player)
+{
+    Q_ASSERT(player);
+    QString id = player->playerId();
+    rawCommand({ id, u"alarms"_qs, 0, 1000, u"filter:all"_qs }, std::bind(&SqueezeBoxServer::onPlayerAlarmsReply, this, id, _1));
+    command({ id, u"playerpref"_qs, u"alarmsEnabled"_qs, u"?"_qs }, std::bind(&SqueezeBoxServer::onPlayerPrefAlarmsEnabledReply, this, id, _1));
+
+    if (m_transport == Transport::JsonRpc) {
+        cometSubscribePlayer(id);
+    } else {
+        // the server pushes the now-playing state on every change: we do this on the listen
+        // connection, so these unsolicited replies don't interfere with the command pipeline
+        m_listen.write(QUrl::toPercentEncoding(id) + " status - 1 subscribe%3A0 tags%3AacdlK\n");
+    }
 }
 
 QVariantList SqueezeBoxAlarm::dayOfWeekListFromString(const QString &s)
@@ -123,11 +158,10 @@ QString SqueezeBoxAlarm::dayOfWeekListToString(const QVariantList &vl)
 }
 
 
-void SqueezeBoxServer::onPlayerAlarmsReply(const QString &playerId, const QStringList &result)
+void SqueezeBoxServer::onPlayerAlarmsReply(const QString &playerId, const RawArgs &result)
 {
-    const auto parsed = SqueezeBoxServer::parseExtendedResult(result, u"id"_qs);
-
-    if (parsed.first.value(u"count"_qs).toInt() != parsed.second.count())
+    QVector<AlarmInfo> sbalarms;
+    if (!decodeAlarmsReply(result, sbalarms))
         return;
 
     SqueezeBoxPlayer *player = m_players.value(playerId);
@@ -136,67 +170,99 @@ void SqueezeBoxServer::onPlayerAlarmsReply(const QString &playerId, const QStrin
 
     QStringList existingAlarmIds = player->m_alarms.keys();
 
-    for (const auto &sbalarm : parsed.second) {
-        QString id = sbalarm.value(u"id"_qs);
+    for (const auto &sbalarm : std::as_const(sbalarms)) {
+        const QString &id = sbalarm.m_id;
 
         auto it = player->m_alarms.constFind(id);
         if (it != player->m_alarms.cend()) {
-            auto alarm = *it;
-
-            bool newRepeat = sbalarm.value(u"repeat"_qs) == u"1";
-            bool newEnabled = sbalarm.value(u"enabled"_qs) == u"1";
-            int newTime = sbalarm.value(u"time"_qs).toInt();
-            QVariantList newDow = SqueezeBoxAlarm::dayOfWeekListFromString(sbalarm.value(u"dow"_qs));
-            qreal newVolume = sbalarm.value(u"volume"_qs).toDouble();
-            QUrl newUrl = sbalarm.value(u"url"_qs);
-
-            if (alarm->m_enabled != newEnabled) {
-                alarm->m_enabled = newEnabled;
-                emit alarm->enabledChanged(newEnabled);
-            }
-            if (alarm->m_repeat != newRepeat) {
-                alarm->m_repeat = newRepeat;
-                emit alarm->repeatChanged(newRepeat);
-            }
-            if (alarm->m_time != newTime) {
-                alarm->m_time = newTime;
-                emit alarm->timeChanged(newTime);
-            }
-            if (alarm->m_dayOfWeek != newDow) {
-                alarm->m_dayOfWeek = newDow;
-                emit alarm->dayOfWeekChanged();
-            }
-            if (!qFuzzyCompare(alarm->m_volume, newVolume)) {
-                alarm->m_volume = newVolume;
-                emit alarm->volumeChanged(newVolume);
-            }
-            if (alarm->m_url != newUrl) {
-                alarm->m_url = newUrl;
-                emit alarm->urlChanged(newUrl);
-            }
+            applyAlarmInfo(*it, sbalarm, AllAlarmFields);
             existingAlarmIds.removeOne(id);
         } else {
             auto alarm = new SqueezeBoxAlarm(player);
             QQmlEngine::setObjectOwnership(alarm, QQmlEngine::CppOwnership);
             alarm->m_alarmId = id;
-            alarm->m_enabled = sbalarm.value(u"enabled"_qs) == u"1";
-            alarm->m_repeat = sbalarm.value(u"repeat"_qs) == u"1";
-            alarm->m_time = sbalarm.value(u"time"_qs).toInt();
-            alarm->m_dayOfWeek = SqueezeBoxAlarm::dayOfWeekListFromString(sbalarm.value(u"dow"_qs));
-            alarm->m_volume = sbalarm.value(u"volume"_qs).toDouble() / 100.;
-            alarm->m_url = sbalarm.value(u"url"_qs);
+            alarm->m_enabled = sbalarm.m_enabled;
+            alarm->m_repeat = sbalarm.m_repeat;
+            alarm->m_time = sbalarm.m_time;
+            alarm->m_dayOfWeek = sbalarm.m_dayOfWeek;
+            alarm->m_volume = sbalarm.m_volume;
+            alarm->m_url = sbalarm.m_url;
             player->m_alarms.insert(id, alarm);
             emit player->alarmsChanged();
             emit player->alarmAdded(alarm);
         }
     }
 
-    for (const auto &id : existingAlarmIds) {
-        emit player->alarmRemoved(player->m_alarms.value(id));
-        player->m_alarms.remove(id);
+    for (const auto &id : existingAlarmIds)
+        player->removeAlarm(id);
+    player->updateNextAlarm();
+}
+
+void SqueezeBoxServer::applyAlarmInfo(SqueezeBoxAlarm *alarm, const AlarmInfo &info, uint fields)
+{
+    if ((fields & AlarmEnabledField) && (alarm->m_enabled != info.m_enabled)) {
+        alarm->m_enabled = info.m_enabled;
+        emit alarm->enabledChanged(info.m_enabled);
+    }
+    if ((fields & AlarmRepeatField) && (alarm->m_repeat != info.m_repeat)) {
+        alarm->m_repeat = info.m_repeat;
+        emit alarm->repeatChanged(info.m_repeat);
+    }
+    if ((fields & AlarmTimeField) && (alarm->m_time != info.m_time)) {
+        alarm->m_time = info.m_time;
+        emit alarm->timeChanged(info.m_time);
+    }
+    if ((fields & AlarmDayOfWeekField) && (alarm->m_dayOfWeek != info.m_dayOfWeek)) {
+        alarm->m_dayOfWeek = info.m_dayOfWeek;
+        emit alarm->dayOfWeekChanged();
+    }
+    if ((fields & AlarmVolumeField) && !qFuzzyCompare(alarm->m_volume, info.m_volume)) {
+        alarm->m_volume = info.m_volume;
+        emit alarm->volumeChanged(info.m_volume);
+    }
+    if ((fields & AlarmUrlField) && (alarm->m_url != info.m_url)) {
+        alarm->m_url = info.m_url;
+        emit alarm->urlChanged(info.m_url);
+    }
+}
+
+void SqueezeBoxServer::onAlarmNotification(SqueezeBoxPlayer *player, const RawArgs &args)
+{
+    // <playerid> alarm <add|update|delete> <tag:value>...
+    AlarmInfo info;
+    uint fields = 0;
+    QByteArrayView tag;
+    QByteArrayView value;
+    for (qsizetype i = 3; i < args.size(); ++i) {
+        if (splitTaggedArg(args.at(i), tag, value))
+            fields |= decodeAlarmTag(tag, value, info);
+    }
+
+    const QByteArrayView cmd = args.at(2);
+    auto *alarm = (fields & AlarmIdField) ? player->m_alarms.value(info.m_id) : nullptr;
+
+    if (alarm && (cmd == "delete")) {
+        player->removeAlarm(info.m_id);
+        return;
+    } else if (alarm && (cmd == "update")) {
+        applyAlarmInfo(alarm, info, fields);
+        player->scheduleAlarm(alarm);
+        return;
+    } else if (!alarm && (cmd == "add") && ((fields & AllAlarmFields) == AllAlarmFields)) {
+        alarm = new SqueezeBoxAlarm(player);
+        QQmlEngine::setObjectOwnership(alarm, QQmlEngine::CppOwnership);
+        alarm->m_alarmId = info.m_id;
+        applyAlarmInfo(alarm, info, fields);
+        player->m_alarms.insert(info.m_id, alarm);
         emit player->alarmsChanged();
+        emit player->alarmAdded(alarm);
+        player->scheduleAlarm(alarm);
+        return;
     }
-    player->updateNextAlarm();
+
+    // an unknown alarm, or an add that relies on the server's defaults: fall back to a full query
+    const QString id = player->playerId();
+    rawCommand({ id, u"alarms"_qs, 0, 1000, u"filter:all"_qs }, std::bind(&SqueezeBoxServer::onPlayerAlarmsReply, this, id, _1));
 }
 
 void SqueezeBoxServer::onPlayerPrefAlarmsEnabledReply(const QString &playerId, const QStringList &result)
@@ -223,12 +289,216 @@ SqueezeBoxServer *SqueezeBoxServer::createInstance(const QString &serverHost, in
     if (Q_UNLIKELY(s_instance))
         qFatal("SqueezeBoxServer::createInstance() was called a second time.");
 
-    s_instance = new SqueezeBoxServer(serverHost, serverPort, parent);
-    QMetaObject::invokeMethod(s_instance, &SqueezeBoxServer::connectSockets);
-
+    s_instance = create(serverHost, serverPort, parent);
     return s_instance;
 }
 
+SqueezeBoxServer *SqueezeBoxServer::create(const QString &serverHost, int serverPort, QObject *parent)
+{
+    auto *server = new SqueezeBoxServer(serverHost, serverPort, parent);
+    // queued, so that the setters called right after this are taken into account
+    QMetaObject::invokeMethod(server, &SqueezeBoxServer::connectSockets, Qt::QueuedConnection);
+    return server;
+}
+
+void SqueezeBoxServer::disconnectFromServer()
+{
+    m_disconnectRequested = true;
+
+    // aborting the sockets emits connectedChanged() synchronously, so the sockets are quiet
+    // afterwards, even in their destructors
+    if (m_transport == Transport::JsonRpc) {
+        cometDisconnected();
+    } else {
+        m_command.abort();
+        m_listen.abort();
+    }
+    m_reconnectTimer.stop();
+}
+
+void SqueezeBoxServer::setTransport(Transport transport)
+{
+    m_transport = transport;
+    if ((m_transport == Transport::JsonRpc) && !m_nam)
+        m_nam = new QNetworkAccessManager(this);
+}
+
+void SqueezeBoxServer::setDiscoveryEnabled(bool enabled)
+{
+    m_discoveryEnabled = enabled;
+    m_disabled = m_serverHost.isEmpty() && !enabled;
+}
+
+void SqueezeBoxServer::discover()
+{
+    if (!m_discovery) {
+        m_discovery = new QUdpSocket(this);
+        connect(m_discovery, &QUdpSocket::readyRead, this, &SqueezeBoxServer::onDiscoveryReply);
+        if (!m_discovery->bind(QHostAddress::AnyIPv4))
+            qWarning() << "SqueezeBox discovery: cannot bind the UDP socket:" << m_discovery->errorString();
+    }
+
+    qWarning() << "Looking for a SqueezeBox server via UDP broadcast";
+
+    // 'e', followed by the TLV tags we want to have in the answer, all with a zero length
+    static const char request[] = "eIPAD\0NAME\0JSON\0CLIP\0";
+    m_discovery->writeDatagram(request, sizeof(request) - 1, QHostAddress::Broadcast, 3483);
+
+    // no answer: try again
+    if (!m_reconnectTimer.isActive())
+        m_reconnectTimer.start();
+}
+
+void SqueezeBoxServer::onDiscoveryReply()
+{
+    while (m_discovery && m_discovery->hasPendingDatagrams()) {
+        const auto datagram = m_discovery->receiveDatagram();
+        const QByteArray data = datagram.data();
+
+        // our own broadcast comes back to us as well, but it starts with a lower-case 'e'
+        if (!data.startsWith('E'))
+            continue;
+
+        QString name;
+        QString host;
+        quint16 jsonPort = 0;
+        quint16 cliPort = 0;
+
+        // 'E', followed by TLVs: a 4 character tag, a 1 byte length and the value
+        QByteArrayView tlvs = QByteArrayView(data).sliced(1);
+        while (tlvs.size() >= 5) {
+            const auto tag = tlvs.first(4);
+            const auto len = qsizetype(quint8(tlvs.at(4)));
+            if (tlvs.size() < (5 + len))
+                break;
+            const auto value = tlvs.sliced(5, len);
+            tlvs = tlvs.sliced(5 + len);
+
+            if (tag == "NAME")
+                name = QString::fromUtf8(value);
+            else if (tag == "IPAD")
+                host = QString::fromLatin1(value);
+            else if (tag == "JSON")
+                jsonPort = value.toUShort();
+            else if (tag == "CLIP")
+                cliPort = value.toUShort();
+        }
+
+        if (host.isEmpty()) {
+            // older servers do not answer the IPAD query
+            bool isIPv4 = false;
+            const quint32 ipv4 = datagram.senderAddress().toIPv4Address(&isIPv4);
+            host = isIPv4 ? QHostAddress(ipv4).toString() : datagram.senderAddress().toString();
+        }
+        if (!jsonPort)
+            jsonPort = 9000;
+        if (!cliPort)
+            cliPort = 9090;
+
+        qWarning() << "Discovered the SqueezeBox server" << name << "at" << host;
+
+        m_serverHost = host;
+        m_serverPort = (m_transport == Transport::JsonRpc) ? jsonPort : cliPort;
+        m_httpPort = jsonPort;
+        m_failedConnects = 0;
+
+        m_discovery->deleteLater();
+        m_discovery = nullptr;
+        m_reconnectTimer.stop();
+
+        saveCache();
+        connectSockets();
+    }
+}
+
+static constexpr quint32 CacheMagic = 0x48415342; // HASB
+static constexpr quint32 CacheVersion = 1; // bump this whenever the format changes
+
+QString SqueezeBoxServer::cacheFileName()
+{
+    QDir cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    return cacheDir.absoluteFilePath(u"squeezebox.cache"_qs);
+}
+
+void SqueezeBoxServer::loadCache()
+{
+    QFile f(cacheFileName());
+    if (!f.open(QIODevice::ReadOnly))
+        return;
+
+    QDataStream ds(&f);
+    ds.setVersion(QDataStream::Qt_6_5);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    ds >> magic >> version;
+    if ((magic != CacheMagic) || (version != CacheVersion))
+        return;
+
+    QString host;
+    quint16 port = 0;
+    quint16 httpPort = 0;
+    int transport = 0;
+    QStringList playerIds;
+    QStringList playerNames;
+    QStringList playerIps;
+    ds >> host >> port >> httpPort >> transport >> playerIds >> playerNames >> playerIps;
+
+    if ((ds.status() != QDataStream::Ok) || (playerIds.size() != playerNames.size())
+            || (playerIds.size() != playerIps.size())) {
+        qWarning() << "SqueezeBoxServer: ignoring corrupt cache file" << f.fileName();
+        return;
+    }
+
+    // the ports depend on the transport
+    if (transport != int(m_transport))
+        return;
+
+    if (m_serverHost.isEmpty() && m_discoveryEnabled) {
+        // the last discovered server: if it is not reachable anymore, we discover again
+        m_serverHost = host;
+        m_serverPort = port;
+    } else if ((host != m_serverHost) || (port != m_serverPort)) {
+        return; // the players of a different server
+    }
+    m_httpPort = httpPort;
+
+    for (qsizetype i = 0; i < playerIds.size(); ++i) {
+        const QString &name = playerNames.at(i);
+        if ((m_nameFilter.isEmpty() || m_nameFilter.contains(name)) && !m_players.contains(playerIds.at(i)))
+            addPlayer(playerIds.at(i), name, playerIps.at(i))->updateStale(true);
+    }
+}
+
+void SqueezeBoxServer::saveCache() const
+{
+    QDir().mkpath(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+
+    QSaveFile f(cacheFileName());
+    if (!f.open(QIODevice::WriteOnly)) {
+        qWarning() << "SqueezeBoxServer: cannot write cache file" << f.fileName() << ":" << f.errorString();
+        return;
+    }
+
+    QStringList playerIds;
+    QStringList playerNames;
+    QStringList playerIps;
+    for (const auto *player : m_players) {
+        playerIds << player->m_playerId;
+        playerNames << player->m_name;
+        playerIps << player->m_address;
+    }
+
+    QDataStream ds(&f);
+    ds.setVersion(QDataStream::Qt_6_5);
+    ds << CacheMagic << CacheVersion
+       << m_serverHost << m_serverPort << m_httpPort << int(m_transport)
+       << playerIds << playerNames << playerIps;
+
+    if (ds.status() == QDataStream::Ok)
+        f.commit();
+}
+
 void SqueezeBoxServer::setPlayerNameFilter(const QStringList &nameFilter)
 {
     m_nameFilter = nameFilter;
@@ -239,6 +509,12 @@ void SqueezeBoxServer::setThisPlayerName(const QString &thisPlayerName)
     m_thisPlayerName = thisPlayerName;
 }
 
+void SqueezeBoxServer::setCommandWindowSize(int windowSize)
+{
+    m_windowSize = qMax(1, windowSize);
+    sendPending();
+}
+
 void SqueezeBoxServer::setThisPlayerAlarmState(const QString &newState)
 {
     // Android only -- we get an Intent when the alarm has already gone active
@@ -281,21 +557,19 @@ SqueezeBoxServer::SqueezeBoxServer(const QString &serverHost, int serverPort, QO
     , m_serverHost(serverHost)
     , m_serverPort(quint16(serverPort))
 {
-    m_disabled = m_serverHost.isEmpty();
-    if (m_disabled)
-        qWarning() << "SqueezeBoxServer is disabled due to missing configuration";
+    m_disabled = m_serverHost.isEmpty(); // see setDiscoveryEnabled()
 
     auto allAdrs = QNetworkInterface::allAddresses();
     std::for_each(allAdrs.cbegin(), allAdrs.cend(), [this](const auto &adr) {
-        m_ipAddresses << adr.toString();
+        m_ipAddresses.insert(adr.toString());
     });
 
     connect(&m_listen, &QTcpSocket::readyRead, this, [this]() {
-        m_listenData.append(m_listen.readAll());
+        m_listenBuffer.read(&m_listen);
         parseListenData();
     });
     connect(&m_command, &QTcpSocket::readyRead, this, [this]() {
-        m_commandData.append(m_command.readAll());
+        m_commandBuffer.read(&m_command);
         parseCommandData();
     });
 
@@ -344,73 +618,73 @@ SqueezeBoxServer::SqueezeBoxServer(const QString &serverHost, int serverPort, QO
     connect(this, &SqueezeBoxServer::connectedChanged, this, [this]() {
         if (m_connected) {
             // no login support atm
-            m_listen.write("listen\r\n");
-            command({ u"players"_qs, 0, 1000 }, std::bind(&SqueezeBoxServer::onPlayersReply, this, _1));
-        } else {
-            while (!m_players.isEmpty()) {
-                auto player = m_players.take(m_players.firstKey());
-                emit playerRemoved(player);
-                if (player == m_thisPlayer) {
-                    m_thisPlayer.clear();
-                    emit thisPlayerChanged();
-                }
-                delete player;
+            if (m_transport == Transport::Cli) {
+                m_listen.write("listen\r\n");
+                command({ u"pref"_qs, u"httpport"_qs, u"?"_qs }, [this](const QStringList &result) {
+                    const auto port = result.value(0).toUShort();
+                    m_httpPort = port ? port : quint16(9000);
+                });
+            } else {
+                m_httpPort = m_serverPort;
             }
-            emit playersChanged();
+            m_failedConnects = 0;
 
-            m_sent.reset();
+            // the cached players are usable right away, the enumeration only reconciles them
+            for (auto *player : std::as_const(m_players))
+                setupPlayer(player);
+            rawCommand({ u"players"_qs, 0, 1000 }, std::bind(&SqueezeBoxServer::onPlayersReply, this, _1));
+        } else {
+            // the players are kept, so the UI doesn't lose them on every network hiccup: after
+            // the reconnect, the players reply reconciles them just like the cached ones
+            for (auto *player : std::as_const(m_players))
+                player->updateStale(true);
+
+            m_inFlight.clear();
             m_outgoing.clear();
-            m_listenData.clear();
-            m_commandData.clear();
+            m_coalesced.clear();
+            m_cometRequests.clear();
+            m_listenBuffer.clear();
+            m_commandBuffer.clear();
         }
     });
 
     connect(this, &SqueezeBoxServer::playerAdded, this, [this](SqueezeBoxPlayer *player) {
         Q_ASSERT(player);
-        QString id = player->playerId();
-        qWarning() << "Added Player" << id;
-        command({ id, u"alarms"_qs, 0, 1000, u"filter:all"_qs }, std::bind(&SqueezeBoxServer::onPlayerAlarmsReply, this, id, _1));
-        command({ id, u"playerpref"_qs, u"alarmsEnabled"_qs, u"?"_qs }, std::bind(&SqueezeBoxServer::onPlayerPrefAlarmsEnabledReply, this, id, _1));
-    });
-
-    connect(this, &SqueezeBoxServer::receivedNotification, this, [this](const QStringList &args) {
-        auto player = m_players.value(args.first());
-
-        if (player) {
-            QString id = player->playerId();
-
-            if (args.size() >= 4) {
-                if (args.at(1) == u"client") {
-                    command({ u"players"_qs, 0, 1000 }, std::bind(&SqueezeBoxServer::onPlayersReply, this, _1));
-                } else if (args.at(1) == u"playerpref" && args.at(2) == u"alarmsEnabled") {
-                    player->updateAlarmsEnabled(args.at(3));
-                } else if (args.at(1) == u"alarm") {
-                    if (args.at(2) == u"update" || args.at(2) == u"add" || args.at(2) == u"delete") {
-                        command({ id, u"alarms"_qs, 0, 1000, u"filter:all"_qs }, std::bind(&SqueezeBoxServer::onPlayerAlarmsReply, this, id, _1));
-                    } else if (args.at(2) == u"sound") {
-                        player->updateAlarmActive(true);
-                    } else if (args.at(2) == u"end") {
-                        player->updateAlarmActive(false);
-                    } else if (args.at(2) == u"snooze") {
-                        player->updateSnoozing(true);
-                    } else if (args.at(2) == u"snooze_end") {
-                        player->updateSnoozing(false);
-                    }
-                }
-            }
-        }
-
-        qWarning() << "SqueezeBox server sent notification" << args;
+        qWarning() << "Added Player" << player->playerId();
+        // players restored from the cache are set up as soon as we are connected
+        if (m_connected)
+            setupPlayer(player);
     });
 }
 
 void SqueezeBoxServer::connectSockets()
 {
-    if (m_disabled || m_connected)
+    if (m_disabled) {
+        qWarning() << "SqueezeBoxServer is disabled due to missing configuration";
+        return;
+    }
+    if (m_disconnectRequested)
+        return;
+    if (!m_cacheLoaded) {
+        m_cacheLoaded = true;
+        loadCache();
+    }
+    if (m_connected)
         return;
 
+    if (m_discoveryEnabled && (m_serverHost.isEmpty() || (m_failedConnects >= 3))) {
+        discover();
+        return;
+    }
+    ++m_failedConnects;
+
     qWarning() << "Connecting to the SqueezeBox server at" << m_serverHost << "port" << m_serverPort;
 
+    if (m_transport == Transport::JsonRpc) {
+        cometHandshake();
+        return;
+    }
+
     m_command.connectToHost(m_serverHost, m_serverPort);
     m_listen.connectToHost(m_serverHost, m_serverPort);
 }
@@ -424,34 +698,226 @@ void SqueezeBoxServer::command(const QVariantList &args, const std::function<voi
     send(sl, callback);
 }
 
-QPair<StringMap, QVector<StringMap>> SqueezeBoxServer::parseExtendedResult(const QStringList &result, const QString &separatorTag)
+void SqueezeBoxServer::rawCommand(const QVariantList &args, const RawCallback &callback)
 {
-    StringMap global;
-    QVector<StringMap> objects;
-    StringMap currentObject;
-    bool inObject = false;
+    QStringList sl;
+    sl.reserve(args.size());
+    for (const auto &arg : args)
+        sl << arg.toString();
+    send(sl, {}, callback);
+}
 
-    for (const auto &tagValue : result) {
-        auto pos = tagValue.indexOf(u':');
-        const QString tag(pos <= 0 ? QString() : tagValue.left(pos));
-        const QString value(tagValue.mid(pos + 1));
+bool SqueezeBoxServer::splitTaggedArg(QByteArrayView rawArg, QByteArrayView &tag, QByteArrayView &rawValue)
+{
+    // tags never contain a colon, so the first (encoded) one is the separator. Tags can contain
+    // (encoded) spaces though, e.g. "playlist%20index"
+    for (qsizetype i = 1; i < rawArg.size(); ++i) {
+        const char c = rawArg.at(i);
+        if (c == ':') {
+            tag = rawArg.first(i);
+            rawValue = rawArg.sliced(i + 1);
+            return true;
+        } else if (c == '%') {
+            const auto escape = rawArg.sliced(i);
+            if (escape.startsWith("%3A") || escape.startsWith("%3a")) {
+                tag = rawArg.first(i);
+                rawValue = rawArg.sliced(i + 3);
+                return true;
+            }
+            i += 2;
+        }
+    }
+    return false;
+}
+
+bool SqueezeBoxServer::decodePlayersReply(const RawArgs &args, QVector<PlayerInfo> &players)
+{
+    int count = -1;
+    QByteArrayView tag;
+    QByteArrayView value;
 
-        if (tag == separatorTag) {
-            if (inObject && !currentObject.isEmpty())
-                objects << currentObject;
-            currentObject.clear();
-            inObject = true;
+    for (const auto &arg : args) {
+        if (!splitTaggedArg(arg, tag, value))
+            continue;
+
+        if (tag == "playerindex") {
+            players.emplace_back();
+        } else if (players.isEmpty()) {
+            if (tag == "count")
+                count = value.toInt();
+        } else if (tag == "playerid") {
+            players.last().m_id = decodeArg(value);
+        } else if (tag == "ip") {
+            const auto portSeparator = value.lastIndexOf("%3A"); // chop off port number
+            players.last().m_ip = decodeArg((portSeparator < 0) ? QByteArrayView() : value.first(portSeparator));
+        } else if (tag == "name") {
+            players.last().m_name = decodeArg(value);
         }
+    }
+    return count == players.size();
+}
 
-        if (inObject)
-            currentObject.insert(tag, value);
-        else
-            global.insert(tag, value);
+bool SqueezeBoxServer::decodeAlarmsReply(const RawArgs &args, QVector<AlarmInfo> &alarms)
+{
+    int count = -1;
+    QByteArrayView tag;
+    QByteArrayView value;
+
+    for (const auto &arg : args) {
+        if (!splitTaggedArg(arg, tag, value))
+            continue;
+
+        if (tag == "id")
+            alarms.emplace_back();
+
+        if (!alarms.isEmpty())
+            decodeAlarmTag(tag, value, alarms.last());
+        else if (tag == "count")
+            count = value.toInt();
     }
-    if (!currentObject.isEmpty())
-        objects << currentObject;
+    return count == alarms.size();
+}
 
-    return qMakePair(global, objects);
+uint SqueezeBoxServer::decodeAlarmTag(QByteArrayView tag, QByteArrayView value, AlarmInfo &alarm)
+{
+    if (tag == "id") {
+        alarm.m_id = decodeArg(value);
+        return AlarmIdField;
+    } else if (tag == "enabled") {
+        alarm.m_enabled = (value == "1");
+        return AlarmEnabledField;
+    } else if (tag == "repeat") {
+        alarm.m_repeat = (value == "1");
+        return AlarmRepeatField;
+    } else if (tag == "time") {
+        alarm.m_time = value.toInt();
+        return AlarmTimeField;
+    } else if (tag == "volume") {
+        alarm.m_volume = value.toDouble() / 100.;
+        return AlarmVolumeField;
+    } else if (tag == "url") {
+        alarm.m_url = QUrl(decodeArg(value));
+        return AlarmUrlField;
+    } else if (tag == "dow") {
+        // a comma separated list of day numbers: 0 (Sunday) to 6
+        alarm.m_dayOfWeek.clear();
+        const auto decoded = decodeRawArg(value);
+        for (const char c : decoded) {
+            if (c >= '0' && c <= '6')
+                alarm.m_dayOfWeek << int(c - '0');
+        }
+        return AlarmDayOfWeekField;
+    }
+    return 0;
+}
+
+bool SqueezeBoxServer::decodeStatusReply(const RawArgs &args, SqueezeBoxPlayer::NowPlaying &nowPlaying,
+                                         QVector<SqueezeBoxTrack> &tracks)
+{
+    QByteArrayView tag;
+    QByteArrayView value;
+    QString currentTitle; // for radio streams
+
+    for (const auto &arg : args) {
+        if (!splitTaggedArg(arg, tag, value))
+            continue;
+
+        if (tag == "playlist%20index") {
+            tracks.emplace_back();
+        } else if (tracks.isEmpty()) {
+            if (tag == "mode")
+                nowPlaying.m_mode = decodeArg(value);
+            else if (tag == "time")
+                nowPlaying.m_time = value.toDouble();
+            else if (tag == "duration")
+                nowPlaying.m_duration = value.toDouble();
+            else if (tag == "mixer%20volume")
+                nowPlaying.m_volume = qAbs(value.toInt()); // negative while muted
+            else if (tag == "playlist_cur_index")
+                nowPlaying.m_playlistIndex = value.toInt();
+            else if (tag == "playlist_timestamp")
+                nowPlaying.m_playlistTimestamp = value.toByteArray();
+            else if (tag == "current_title")
+                currentTitle = decodeArg(value);
+        } else if (tag == "id") {
+            tracks.last().m_trackId = decodeArg(value);
+        } else if (tag == "title") {
+            tracks.last().m_title = decodeArg(value);
+        } else if (tag == "artist") {
+            tracks.last().m_artist = decodeArg(value);
+        } else if (tag == "album") {
+            tracks.last().m_album = decodeArg(value);
+        } else if (tag == "duration") {
+            tracks.last().m_duration = value.toDouble();
+        } else if (tag == "coverid") {
+            tracks.last().m_coverArt = QUrl(u"image://squeezebox/"_qs + decodeArg(value));
+        } else if (tag == "artwork_url") {
+            if (tracks.last().m_coverArt.isEmpty())
+                tracks.last().m_coverArt = httpUrl(decodeArg(value));
+        }
+    }
+    if (!tracks.isEmpty() && tracks.first().m_title.isEmpty())
+        tracks.first().m_title = currentTitle;
+    return !nowPlaying.m_mode.isEmpty();
+}
+
+void SqueezeBoxServer::encodeArgs(const QStringList &args, QByteArrayList &storage, RawArgs &rawArgs)
+{
+    storage.reserve(args.size());
+    for (const auto &arg : args)
+        rawArgs.append(storage.emplace_back(QUrl::toPercentEncoding(arg)));
+}
+
+QUrl SqueezeBoxServer::httpUrl(const QString &pathOrUrl) const
+{
+    QUrl url(pathOrUrl);
+    if (url.isRelative()) {
+        url.setScheme(u"http"_qs);
+        url.setHost(m_serverHost);
+        url.setPort(m_httpPort);
+        if (!url.path().startsWith(u'/'))
+            url.setPath(u'/' + url.path());
+    }
+    return url;
+}
+
+QUrl SqueezeBoxServer::coverArtUrl(const QString &coverId, const QSize &size) const
+{
+    return httpUrl(u"/music/%1/cover_%2x%3"_qs.arg(coverId).arg(size.width()).arg(size.height()));
+}
+
+void SqueezeBoxServer::onPlayerStatusReply(const QString &playerId, const RawArgs &result)
+{
+    auto player = m_players.value(playerId);
+    if (!player)
+        return;
+
+    // this is a "status - 1" reply, so the only track is the current one
+    SqueezeBoxPlayer::NowPlaying nowPlaying;
+    QVector<SqueezeBoxTrack> tracks;
+    if (!decodeStatusReply(result, nowPlaying, tracks))
+        return;
+    nowPlaying.m_track = tracks.value(0);
+
+    const bool playlistChanged = (nowPlaying.m_playlistTimestamp != player->m_nowPlaying.m_playlistTimestamp);
+    player->updateNowPlaying(nowPlaying);
+
+    if (playlistChanged) {
+        rawCommand({ playerId, u"status"_qs, 0, 1000, u"tags:acdlK"_qs },
+                   std::bind(&SqueezeBoxServer::onPlayerPlaylistReply, this, playerId, _1));
+    }
+}
+
+void SqueezeBoxServer::onPlayerPlaylistReply(const QString &playerId, const RawArgs &result)
+{
+    auto player = m_players.value(playerId);
+    if (!player)
+        return;
+
+    SqueezeBoxPlayer::NowPlaying nowPlaying;
+    QVector<SqueezeBoxTrack> tracks;
+    if (decodeStatusReply(result, nowPlaying, tracks))
+        player->m_playlist->update(tracks);
 }
 
 QList<SqueezeBoxPlayer *> SqueezeBoxServer::players() const
@@ -469,107 +935,600 @@ bool SqueezeBoxServer::connected() const
     return m_connected;
 }
 
-void SqueezeBoxServer::send(const QStringList &args, const std::function<void (const QStringList &)> &callback)
+void SqueezeBoxServer::send(const QStringList &args, const std::function<void (const QStringList &)> &callback,
+                            const RawCallback &rawCallback, const QString &coalesceKey)
 {
     if (!m_connected)
         return;
 
-    QByteArray out;
     qWarning() << "SqueezeBox server sending command:" << args;
 
+    // player commands start with the player's id
+    QString playerId;
+    if (!args.isEmpty() && m_players.contains(args.constFirst()))
+        playerId = args.constFirst();
+
+    static quint64 counter = 0;
+    m_outgoing.enqueue(Command { ++counter, encodeCommand(args), playerId, callback, rawCallback, coalesceKey });
+    sendPending();
+}
+
+QByteArray SqueezeBoxServer::encodeCommand(const QStringList &args)
+{
+    QByteArray out;
     for (const auto &arg : args) {
         auto rawArg = QUrl::toPercentEncoding(arg);
         if (!out.isEmpty())
             out.append(' ');
         out.append(rawArg);
     }
+    return out;
+}
 
-    static quint64 counter = 0;
-    Command c { ++counter, out, callback };
+void SqueezeBoxServer::coalescedCommand(const QString &playerId, const QString &kind, const QVariantList &args)
+{
+    if (!m_connected)
+        return;
 
-    if (!m_sent) {
-        m_sent = c;
-        m_command.write(c.raw + '\n');
-    } else {
-        m_outgoing.enqueue(c);
+    QStringList sl { playerId };
+    sl.reserve(args.size() + 1);
+    for (const auto &arg : args)
+        sl << arg.toString();
+
+    const QString key = coalesceKey(playerId, kind);
+
+    // still queued, but not sent yet: just replace the arguments
+    for (auto &c : m_outgoing) {
+        if (c.coalesceKey == key) {
+            c.raw = encodeCommand(sl);
+            return;
+        }
     }
+
+    // one already in flight: remember only the newest value and send it when that is answered,
+    // so we never send more than one per round-trip
+    auto it = m_coalesced.find(key);
+    if (it != m_coalesced.end()) {
+        *it = sl;
+        return;
+    }
+    m_coalesced.insert(key, { });
+
+    // the key has to be set before sendPending() moves the command out of m_outgoing
+    send(sl, { }, { }, key);
 }
 
-void SqueezeBoxServer::parseCommandData()
+QString SqueezeBoxServer::coalesceKey(const QString &playerId, const QString &kind)
+{
+    return playerId + u' ' + kind;
+}
+
+bool SqueezeBoxServer::isCoalescing(const QString &playerId, const QString &kind) const
+{
+    return m_coalesced.contains(coalesceKey(playerId, kind));
+}
+
+void SqueezeBoxServer::finishCoalesced(const QString &key)
 {
-    do {
-        auto eol = m_commandData.indexOf('\n');
-        if (eol < 0)
+    if (key.isEmpty() || !m_connected)
+        return;
+
+    const QStringList next = m_coalesced.take(key);
+    if (!next.isEmpty()) {
+        m_coalesced.insert(key, { });
+        send(next, { }, { }, key);
+    }
+}
+
+void SqueezeBoxServer::sendPending()
+{
+    if (!m_connected)
+        return;
+
+    if (m_transport == Transport::JsonRpc) {
+        // all pending requests are batched into a single HTTP request
+        QJsonArray messages;
+        while (!m_outgoing.isEmpty() && (m_cometRequests.size() < m_windowSize)) {
+            const Command c = m_outgoing.dequeue();
+
+            QStringList args;
+            const auto rawArgs = c.raw.split(' ');
+            for (const auto &rawArg : rawArgs)
+                args << QUrl::fromPercentEncoding(rawArg);
+            if (!c.playerId.isEmpty())
+                args.removeFirst();
+
+            const QString response = u"/%1/slim/request/%2"_qs.arg(m_cometClientId).arg(c.id);
+            messages.append(QJsonObject {
+                { u"channel"_qs, u"/slim/request"_qs },
+                { u"clientId"_qs, m_cometClientId },
+                { u"id"_qs, QString::number(c.id) },
+                { u"data"_qs, QJsonObject {
+                      { u"request"_qs, QJsonArray { c.playerId, QJsonArray::fromStringList(args) } },
+                      { u"response"_qs, response } } }
+            });
+            m_cometRequests.insert(c.id, c);
+        }
+        if (!messages.isEmpty())
+            cometPost(messages, std::bind(&SqueezeBoxServer::cometDispatch, this, _1));
+        return;
+    }
+
+    QByteArray out;
+    while (!m_outgoing.isEmpty() && (m_inFlight.size() < m_windowSize)) {
+        const Command &c = m_inFlight.emplace_back(m_outgoing.dequeue());
+        out.append(c.raw);
+        out.append('\n');
+    }
+    // a single write for all the commands, so they end up in as few TCP segments as possible
+    if (!out.isEmpty())
+        m_command.write(out);
+}
+
+void SqueezeBoxServer::LineBuffer::read(QIODevice *device)
+{
+    const qsizetype available = device->bytesAvailable();
+    if (available <= 0)
+        return;
+
+    const qsizetype oldSize = m_data.size();
+    m_data.resize(oldSize + available);
+    const qint64 bytesRead = device->read(m_data.data() + oldSize, available);
+    m_data.resize(oldSize + qMax<qint64>(0, bytesRead));
+}
+
+std::optional<QByteArrayView> SqueezeBoxServer::LineBuffer::nextLine()
+{
+    const auto eol = m_data.indexOf('\n', m_pos);
+    if (eol < 0) {
+        // only the start of an incomplete line (if any) is left: move it to the front
+        if (m_pos > 0) {
+            m_data.remove(0, m_pos);
+            m_pos = 0;
+        }
+        return std::nullopt;
+    }
+    const QByteArrayView line = QByteArrayView(m_data).sliced(m_pos, eol - m_pos).trimmed();
+    m_pos = eol + 1;
+    return line;
+}
+
+void SqueezeBoxServer::tokenize(QByteArrayView line, RawArgs &args)
+{
+    args.clear();
+    while (!line.isEmpty()) {
+        const auto space = line.indexOf(' ');
+        const auto token = (space < 0) ? line : line.first(space);
+        if (!token.isEmpty())
+            args.append(token);
+        if (space < 0)
             break;
+        line = line.sliced(space + 1);
+    }
+}
 
-        QByteArray msg = m_commandData.left(eol).trimmed();
-        m_commandData.remove(0, eol + 1);
+QByteArrayView SqueezeBoxServer::decodeRawArg(QByteArrayView rawArg)
+{
+    if (!rawArg.contains('%'))
+        return rawArg;
+
+    // same as QUrl::fromPercentEncoding, but without a temporary QByteArray per argument
+    auto hexValue = [](char c) -> int {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        c |= 0x20;
+        return (c >= 'a' && c <= 'f') ? (c - 'a' + 10) : -1;
+    };
+
+    m_decodeArena.resize(0); // keeps the capacity
+    for (qsizetype i = 0; i < rawArg.size(); ++i) {
+        const char c = rawArg.at(i);
+        if (c == '%' && (i + 2) < rawArg.size()) {
+            const int hi = hexValue(rawArg.at(i + 1));
+            const int lo = hexValue(rawArg.at(i + 2));
+            if (hi >= 0 && lo >= 0) {
+                m_decodeArena.append(char((hi << 4) | lo));
+                i += 2;
+                continue;
+            }
+        }
+        m_decodeArena.append(c);
+    }
+    return m_decodeArena;
+}
+
+QString SqueezeBoxServer::decodeArg(QByteArrayView rawArg)
+{
+    return QString::fromUtf8(decodeRawArg(rawArg));
+}
+
+QStringList SqueezeBoxServer::decodeArgs(const RawArgs &args, qsizetype from)
+{
+    QStringList result;
+    result.reserve(args.size() - from);
+    for (qsizetype i = from; i < args.size(); ++i)
+        result << decodeArg(args.at(i));
+    return result;
+}
+
+void SqueezeBoxServer::parseCommandData()
+{
+    while (auto line = m_commandBuffer.nextLine()) {
+        QByteArrayView msg = *line;
 
-        if (!m_sent) {
+        if (m_inFlight.isEmpty()) {
             qWarning() << "SqueezeBox server sent a reply, but we weren't expecting one:\n" << msg;
             continue;
         }
 
-        QByteArray sentRaw = m_sent->raw;
-        if (sentRaw.endsWith("%3F")) // ? query
-            sentRaw.chop(4);
+        auto replyPrefix = [](const Command &c) {
+            QByteArrayView sentRaw = c.raw;
+            if (sentRaw.endsWith("%3F")) // ? query, including the preceding space
+                sentRaw.chop(qMin<qsizetype>(4, sentRaw.size()));
+            return sentRaw;
+        };
+
+        // normally this is the oldest command in flight, but we fall back to matching the
+        // echoed prefix in case the server skipped a reply
+        qsizetype matched = -1;
+        for (qsizetype i = 0; i < m_inFlight.size(); ++i) {
+            if (msg.startsWith(replyPrefix(m_inFlight.at(i)))) {
+                matched = i;
+                break;
+            }
+        }
 
-        if (!msg.startsWith(sentRaw)) {
+        if (matched < 0) {
             qWarning() << "SqueezeBox server sent a reply, but we were expecting a different one:\n"
-                          "    wanted:" << m_sent->raw << "\n"
+                          "    wanted:" << m_inFlight.head().raw << "\n"
                           "  received:" << msg;
             continue;
+        } else if (matched > 0) {
+            // replies are in order: the skipped commands will never get an answer
+            qWarning() << "SqueezeBox server did not reply to" << matched << "command(s), first one:"
+                       << m_inFlight.head().raw;
+            for (qsizetype i = 0; i < matched; ++i)
+                finishCoalesced(m_inFlight.dequeue().coalesceKey);
         }
 
-        msg.remove(0, sentRaw.size() + 1); // also remove the following space
+        const Command sent = m_inFlight.dequeue();
+        msg = msg.sliced(qMin(replyPrefix(sent).size() + 1, msg.size())); // also remove the following space
 
         //qWarning() << "RECEIVED REPLY:" << msg;
 
-        const auto rawArgs = msg.split(' ');
-        QStringList args;
-        args.reserve(rawArgs.size());
-        for (const auto &rawArg : rawArgs)
-            args << QUrl::fromPercentEncoding(rawArg);
-        if (m_sent->callback)
-            m_sent->callback(args);
+        RawArgs rawArgs;
+        tokenize(msg, rawArgs);
+        if (sent.rawCallback)
+            sent.rawCallback(rawArgs);
+        else if (sent.callback)
+            sent.callback(decodeArgs(rawArgs));
+        finishCoalesced(sent.coalesceKey);
 
-        m_sent.reset();
+        sendPending();
+    }
+}
 
-        if (!m_outgoing.isEmpty()) {
-            m_sent = m_outgoing.dequeue();
+void SqueezeBoxServer::parseListenData()
+{
+    RawArgs rawArgs;
+
+    while (auto line = m_listenBuffer.nextLine()) {
+        if (*line == "listen")
+            continue;
 
-            if (m_connected)
-                m_command.write(m_sent->raw + '\n');
+        tokenize(*line, rawArgs);
+        if (!rawArgs.isEmpty())
+            handleNotification(rawArgs);
+    }
+}
+
+void SqueezeBoxServer::handleNotification(const RawArgs &args)
+{
+    // LMS broadcasts the playlist and status traffic of all players: anything not concerning
+    // one of our players is dropped here, before any QString is created. The only exception
+    // is "client", which announces new players.
+    const bool isClient = (args.size() >= 3) && (args.at(1) == "client");
+    const QByteArray rawId = QByteArray::fromRawData(args.at(0).data(), args.at(0).size());
+    if (!isClient && !m_rawPlayerIds.contains(rawId))
+        return;
+
+    if ((args.size() >= 2) && (args.at(1) == "status")) {
+        // our own subscription: not worth logging, this arrives on every change
+        onPlayerStatusReply(decodeArg(args.at(0)), args);
+        return;
+    }
+
+    if (isClient) {
+        rawCommand({ u"players"_qs, 0, 1000 }, std::bind(&SqueezeBoxServer::onPlayersReply, this, _1));
+    } else if (auto player = m_players.value(decodeArg(args.at(0)))) {
+        if (args.size() >= 4) {
+            if (args.at(1) == "playerpref" && args.at(2) == "alarmsEnabled") {
+                player->updateAlarmsEnabled(decodeArg(args.at(3)));
+            } else if (args.at(1) == "alarm") {
+                if (args.at(2) == "update" || args.at(2) == "add" || args.at(2) == "delete") {
+                    onAlarmNotification(player, args);
+                } else if (args.at(2) == "sound") {
+                    player->updateAlarmActive(true);
+                } else if (args.at(2) == "end") {
+                    player->updateAlarmActive(false);
+                } else if (args.at(2) == "snooze") {
+                    player->updateSnoozing(true);
+                } else if (args.at(2) == "snooze_end") {
+                    player->updateSnoozing(false);
+                }
+            }
         }
-    } while (true);
+    }
+
+    if (isSignalConnected(QMetaMethod::fromSignal(&SqueezeBoxServer::receivedNotification)))
+        emit receivedNotification(decodeArgs(args));
 }
 
-void SqueezeBoxServer::parseListenData()
+void SqueezeBoxServer::cometPost(const QJsonArray &messages, const std::function<void (const QJsonArray &)> &onReply)
 {
-    do {
-        auto eol = m_listenData.indexOf('\n');
-        if (eol < 0)
-            break;
+    QUrl url;
+    url.setScheme(u"http"_qs);
+    url.setHost(m_serverHost);
+    url.setPort(m_serverPort);
+    url.setPath(u"/cometd"_qs);
+
+    QNetworkRequest request(url);
+    request.setHeader(QNetworkRequest::ContentTypeHeader, u"application/json"_qs);
+    request.setTransferTimeout(90 * 1000); // the server holds long-polls for up to 60 sec
+
+    auto *reply = m_nam->post(request, QJsonDocument(messages).toJson(QJsonDocument::Compact));
+    connect(reply, &QNetworkReply::finished, this, [this, reply, onReply]() {
+        reply->deleteLater();
+
+        if (reply->error() != QNetworkReply::NoError) {
+            qWarning() << "SqueezeBox server Comet request failed:" << reply->errorString();
+            cometDisconnected();
+            return;
+        }
+        QJsonParseError parseError;
+        const auto doc = QJsonDocument::fromJson(reply->readAll(), &parseError);
+        if (doc.isNull() || !doc.isArray()) {
+            qWarning() << "SqueezeBox server sent an invalid Comet reply:" << parseError.errorString();
+            cometDisconnected();
+            return;
+        }
+        if (onReply)
+            onReply(doc.array());
+    });
+}
+
+void SqueezeBoxServer::cometHandshake()
+{
+    const QJsonArray handshake { QJsonObject {
+        { u"channel"_qs, u"/meta/handshake"_qs },
+        { u"version"_qs, u"1.0"_qs },
+        { u"supportedConnectionTypes"_qs, QJsonArray { u"long-polling"_qs } }
+    } };
+
+    cometPost(handshake, [this](const QJsonArray &messages) {
+        const auto message = messages.at(0).toObject();
+        if (!message.value(u"successful"_qs).toBool()) {
+            qWarning() << "SqueezeBox server rejected the Comet handshake";
+            cometDisconnected();
+            return;
+        }
+        m_cometClientId = message.value(u"clientId"_qs).toString();
+
+        // serverstatus pushes player list changes, the players' status comes via playerAdded
+        const QString cid = m_cometClientId;
+        cometPost(QJsonArray {
+                      QJsonObject {
+                          { u"channel"_qs, u"/meta/subscribe"_qs },
+                          { u"clientId"_qs, cid },
+                          { u"subscription"_qs, u"/%1/**"_qs.arg(cid) } },
+                      QJsonObject {
+                          { u"channel"_qs, u"/slim/subscribe"_qs },
+                          { u"clientId"_qs, cid },
+                          { u"data"_qs, QJsonObject {
+                                { u"response"_qs, u"/%1/slim/serverstatus"_qs.arg(cid) },
+                                { u"request"_qs, QJsonArray { u""_qs, QJsonArray { u"serverstatus"_qs, 0, 1000, u"subscribe:60"_qs } } } } } }
+                  }, [this](const QJsonArray &) {
+            if (!m_connected) {
+                qWarning() << "Connected to the SqueezeBox server via JSON-RPC / Comet";
+                m_connected = true;
+                m_reconnectTimer.stop();
+                emit connectedChanged(m_connected);
+            }
+            cometConnect();
+        });
+    });
+}
+
+void SqueezeBoxServer::cometConnect()
+{
+    // the long-poll: the server answers as soon as it has messages for us
+    const QJsonArray connectMessage { QJsonObject {
+        { u"channel"_qs, u"/meta/connect"_qs },
+        { u"clientId"_qs, m_cometClientId },
+        { u"connectionType"_qs, u"long-polling"_qs }
+    } };
+
+    cometPost(connectMessage, [this](const QJsonArray &messages) {
+        cometDispatch(messages);
+        if (m_connected)
+            cometConnect();
+    });
+}
+
+void SqueezeBoxServer::cometSubscribePlayer(const QString &playerId)
+{
+    const QString cid = m_cometClientId;
+    cometPost(QJsonArray { QJsonObject {
+                  { u"channel"_qs, u"/slim/subscribe"_qs },
+                  { u"clientId"_qs, cid },
+                  { u"data"_qs, QJsonObject {
+                        { u"response"_qs, u"/%1/slim/playerstatus/%2"_qs.arg(cid, playerId) },
+                        { u"request"_qs, QJsonArray { playerId, QJsonArray { u"status"_qs, u"-"_qs, 1, u"subscribe:0"_qs, u"tags:acdlK"_qs } } } } } }
+              }, std::bind(&SqueezeBoxServer::cometDispatch, this, _1));
+}
+
+void SqueezeBoxServer::cometDispatch(const QJsonArray &messages)
+{
+    const QString prefix = u"/%1/slim/"_qs.arg(m_cometClientId);
 
-        const QByteArray msg = m_listenData.left(eol).trimmed();
-        m_listenData.remove(0, eol + 1);
+    for (const auto &m : messages) {
+        const auto message = m.toObject();
+        const QString channel = message.value(u"channel"_qs).toString();
 
-        if (msg == "listen")
+        if (channel == u"/meta/connect") {
+            const auto reconnect = message.value(u"advice"_qs).toObject().value(u"reconnect"_qs).toString();
+            if (!message.value(u"successful"_qs).toBool() || (reconnect == u"handshake")) {
+                cometDisconnected();
+                return;
+            }
             continue;
+        } else if (!channel.startsWith(prefix)) {
+            continue;
+        }
+
+        const QStringView subChannel = QStringView(channel).mid(prefix.size());
+        const QJsonObject data = message.value(u"data"_qs).toObject();
+
+        if (subChannel.startsWith(u"request/")) {
+            const quint64 id = subChannel.mid(8).toULongLong();
+            const Command c = m_cometRequests.take(id);
+            if (c.rawCallback) {
+                // the typed reply decoders work on the CLI's encoding
+                QByteArrayList storage;
+                RawArgs rawArgs;
+                encodeArgs(flattenJsonResult(data), storage, rawArgs);
+                c.rawCallback(rawArgs);
+            } else if (c.callback) {
+                c.callback(flattenJsonResult(data));
+            }
+            finishCoalesced(c.coalesceKey);
+            sendPending();
+        } else if (subChannel == u"serverstatus") {
+            // This is pushed periodically and on all kinds of changes. Only players coming or
+            // going are the equivalent of the CLI's client notification.
+            bool changed;
+            if (data.contains(u"players_loop"_qs)) {
+                QStringList playerIds;
+                const auto players = data.value(u"players_loop"_qs).toArray();
+                for (const auto &player : players)
+                    playerIds << player.toObject().value(u"playerid"_qs).toString();
+                playerIds.sort();
+                changed = (playerIds != m_serverPlayerIds);
+            } else {
+                changed = (data.value(u"player count"_qs).toInt() != m_serverPlayerIds.size());
+            }
+            if (changed)
+                rawCommand({ u"players"_qs, 0, 1000 }, std::bind(&SqueezeBoxServer::onPlayersReply, this, _1));
+        } else if (subChannel.startsWith(u"playerstatus/")) {
+            onPlayerStatus(subChannel.mid(13).toString(), data);
+        }
+    }
+}
+
+void SqueezeBoxServer::onPlayerStatus(const QString &playerId, const QJsonObject &status)
+{
+    auto player = m_players.value(playerId);
+    if (!player)
+        return;
+
+    if (status.contains(u"alarm_state"_qs)) {
+        const QString state = status.value(u"alarm_state"_qs).toString();
+        player->updateAlarmActive((state == u"active") || (state == u"snooze"));
+        player->updateSnoozing(state == u"snooze");
+    }
 
-        const auto rawArgs = msg.split(' ');
-        QStringList args;
-        args.reserve(rawArgs.size());
-        for (const auto &rawArg : rawArgs)
-            args << QUrl::fromPercentEncoding(rawArg);
+    // Comet has no equivalent of the CLI's alarm notifications, but editing, enabling or
+    // disabling alarms changes the next alarm time in the status
+    const QString nextAlarm = status.value(u"alarm_next"_qs).toVariant().toString();
+    auto it = m_nextAlarms.find(playerId);
+    if (it == m_nextAlarms.end()) {
+        m_nextAlarms.insert(playerId, nextAlarm); // setupPlayer() has just queried the alarms
+    } else if (*it != nextAlarm) {
+        *it = nextAlarm;
+        rawCommand({ playerId, u"alarms"_qs, 0, 1000, u"filter:all"_qs }, std::bind(&SqueezeBoxServer::onPlayerAlarmsReply, this, playerId, _1));
+        command({ playerId, u"playerpref"_qs, u"alarmsEnabled"_qs, u"?"_qs }, std::bind(&SqueezeBoxServer::onPlayerPrefAlarmsEnabledReply, this, playerId, _1));
+    }
 
-        if (!args.isEmpty())
-            emit receivedNotification(args);
-    } while (true);
+    QByteArrayList storage;
+    RawArgs rawArgs;
+    encodeArgs(flattenJsonResult(status), storage, rawArgs);
+    onPlayerStatusReply(playerId, rawArgs);
 }
 
-SqueezeBoxPlayer::SqueezeBoxPlayer()
-{ }
+void SqueezeBoxServer::cometDisconnected()
+{
+    m_cometClientId.clear();
+    m_nextAlarms.clear();
+
+    if (m_connected) {
+        qWarning() << "Disconnected from the SqueezeBox server";
+        m_connected = false;
+        emit connectedChanged(m_connected);
+    }
+    if (!m_reconnectTimer.isActive())
+        m_reconnectTimer.start();
+}
+
+QStringList SqueezeBoxServer::flattenJsonResult(const QJsonObject &result)
+{
+    // Convert a JSON-RPC result to the tagged format of the CLI, so that the reply handlers can
+    // be shared between the transports:
+    //   { "count": 1, "players_loop": [ { "playerid": "..." } ] }  ->  count:1 playerindex:0 playerid:...
+    //   { "_p2": "1" }  ->  1
+
+    auto toString = [](const QJsonValue &v) {
+        if (v.isBool())
+            return v.toBool() ? u"1"_qs : u"0"_qs;
+        return v.toVariant().toString();
+    };
+    auto appendTagged = [&toString](QStringList &flat, const QString &tag, const QJsonValue &v) {
+        if (tag.startsWith(u'_'))
+            flat << toString(v); // positional return value of a query
+        else
+            flat << (tag + u':' + toString(v));
+    };
+
+    QStringList flat;
+    QStringList loops;
+    for (auto it = result.begin(); it != result.end(); ++it) {
+        if (it.key().endsWith(u"_loop"))
+            loops << it.key();
+        else
+            appendTagged(flat, it.key(), it.value());
+    }
+
+    // QJsonObject sorts its keys, but the reply decoders need the separator tag first
+    for (const auto &loop : std::as_const(loops)) {
+        const QString separator = (loop == u"players_loop") ? u"playerindex"_qs
+                                  : (loop == u"playlist_loop") ? u"playlist index"_qs : u"id"_qs;
+        const auto objects = result.value(loop).toArray();
+        for (qsizetype i = 0; i < objects.size(); ++i) {
+            const auto object = objects.at(i).toObject();
+            appendTagged(flat, separator, object.contains(separator) ? object.value(separator)
+                                                                     : QJsonValue(qint64(i)));
+            for (auto it = object.begin(); it != object.end(); ++it) {
+                if (it.key() != separator)
+                    appendTagged(flat, it.key(), it.value());
+            }
+        }
+    }
+    return flat;
+}
+
+SqueezeBoxPlayer::SqueezeBoxPlayer(SqueezeBoxServer *server)
+    : m_server(server)
+    , m_playlist(new SqueezeBoxPlaylistModel(this))
+{
+    QQmlEngine::setObjectOwnership(m_playlist, QQmlEngine::CppOwnership);
+
+    m_timeTicker.setInterval(1000);
+    m_timeTicker.callOnTimeout(this, [this]() { emit timeChanged(time()); });
+
+    m_nextAlarmTimer.setSingleShot(true);
+    m_nextAlarmTimer.callOnTimeout(this, &SqueezeBoxPlayer::refreshNextAlarm);
+}
+
+quint64 SqueezeBoxPlayer::s_alarmGeneration = 0;
 
 QString SqueezeBoxPlayer::playerId() const
 {
@@ -623,26 +1582,119 @@ void SqueezeBoxPlayer::updateSnoozing(bool on)
     }
 }
 
+void SqueezeBoxPlayer::updateStale(bool stale)
+{
+    if (stale == m_stale)
+        return;
+    m_stale = stale;
+
+    if (m_stale) {
+        // without status updates, the playing position must not run away
+        m_nowPlaying.m_time = time();
+        m_timeReceived.invalidate();
+        m_timeTicker.stop();
+    }
+    emit staleChanged(m_stale);
+}
+
+QDateTime SqueezeBoxPlayer::nextOccurrence(const SqueezeBoxAlarm *alarm, const QDateTime &after)
+{
+    if (!alarm->enabled())
+        return { };
+
+    const QTime time = QTime(0, 0).addSecs(alarm->time());
+    for (int days = 0; days <= 7; ++days) {
+        const QDate date = after.date().addDays(days);
+        if (alarm->dayOfWeek().contains(date.dayOfWeek() % 7)) {
+            const QDateTime when(date, time);
+            if (when > after)
+                return when;
+        }
+    }
+    return { };
+}
+
 void SqueezeBoxPlayer::updateNextAlarm()
 {
-    QDateTime next;
+    // rebuild the heap from scratch
+    const QDateTime from = QDateTime::currentDateTime();
+
+    m_upcomingAlarms.clear();
+    for (SqueezeBoxAlarm *alarm : std::as_const(m_alarms)) {
+        alarm->m_generation = ++s_alarmGeneration;
+        const QDateTime when = nextOccurrence(alarm, from);
+        if (when.isValid())
+            m_upcomingAlarms.append({ when.toMSecsSinceEpoch(), alarm->m_alarmId, alarm->m_generation });
+    }
+    std::make_heap(m_upcomingAlarms.begin(), m_upcomingAlarms.end(), std::greater<>());
+
+    refreshNextAlarm();
+}
+
+void SqueezeBoxPlayer::scheduleAlarm(SqueezeBoxAlarm *alarm)
+{
+    // the alarm's old heap entry (if any) becomes stale and is dropped once it reaches the top
+    alarm->m_generation = ++s_alarmGeneration;
+    const QDateTime when = nextOccurrence(alarm, QDateTime::currentDateTime());
+    if (when.isValid()) {
+        m_upcomingAlarms.append({ when.toMSecsSinceEpoch(), alarm->m_alarmId, alarm->m_generation });
+        std::push_heap(m_upcomingAlarms.begin(), m_upcomingAlarms.end(), std::greater<>());
+    }
+    refreshNextAlarm();
+}
 
-    for (const SqueezeBoxAlarm *alarm : std::as_const(m_alarms)) {
-        if (alarm->enabled()) {
-            QDate whenDate = QDate::currentDate();
-            auto whenTime = QTime(0, 0).addSecs(alarm->time());
+void SqueezeBoxPlayer::removeAlarm(const QString &alarmId)
+{
+    auto *alarm = m_alarms.value(alarmId);
+    if (!alarm)
+        return;
 
-            if (whenTime < QTime::currentTime())
-                whenDate = whenDate.addDays(1);
+    emit alarmRemoved(alarm);
+    m_alarms.remove(alarmId);
+    emit alarmsChanged();
+    refreshNextAlarm();
+}
 
-            //qWarning() << m_name << alarm->alarmId() << whenDate << whenTime << QTime::currentTime() << alarm->dayOfWeek() << (whenDate.dayOfWeek() % 7) << next;
+void SqueezeBoxPlayer::refreshNextAlarm()
+{
+    // stale entries are only worth cleaning up once they dominate the heap
+    if (m_upcomingAlarms.size() > (2 * m_alarms.size() + 16)) {
+        updateNextAlarm();
+        return;
+    }
 
-            if (alarm->dayOfWeek().contains(whenDate.dayOfWeek() % 7)) {
-                QDateTime when(whenDate, whenTime);
-                if (!next.isValid() || (when < next))
-                    next = when;
+    const QDateTime now = QDateTime::currentDateTime();
+    const qint64 nowMSecs = now.toMSecsSinceEpoch();
+
+    while (!m_upcomingAlarms.isEmpty()) {
+        std::pop_heap(m_upcomingAlarms.begin(), m_upcomingAlarms.end(), std::greater<>());
+        UpcomingAlarm &top = m_upcomingAlarms.last();
+
+        const auto *alarm = m_alarms.value(top.m_alarmId);
+        if (alarm && (alarm->m_generation == top.m_generation)) {
+            if (top.m_time > nowMSecs) {
+                std::push_heap(m_upcomingAlarms.begin(), m_upcomingAlarms.end(), std::greater<>());
+                break;
+            }
+            // this one went off: move it to its next occurrence
+            const QDateTime when = nextOccurrence(alarm, now);
+            if (when.isValid()) {
+                top.m_time = when.toMSecsSinceEpoch();
+                std::push_heap(m_upcomingAlarms.begin(), m_upcomingAlarms.end(), std::greater<>());
+                continue;
             }
         }
+        m_upcomingAlarms.removeLast();
+    }
+
+    QDateTime next;
+    if (!m_upcomingAlarms.isEmpty()) {
+        const qint64 nextMSecs = m_upcomingAlarms.first().m_time;
+        next = QDateTime::fromMSecsSinceEpoch(nextMSecs);
+        // re-check at least hourly, in case the system clock or the time zone changes
+        m_nextAlarmTimer.start(int(qBound<qint64>(0, nextMSecs - nowMSecs + 1, 60 * 60 * 1000)));
+    } else {
+        m_nextAlarmTimer.stop();
     }
 
     if (next != m_nextAlarm) {
@@ -656,12 +1708,35 @@ void SqueezeBoxPlayer::setAlarmsEnabled(bool alarmsEnabled)
     if (m_alarmsEnabled == alarmsEnabled)
         return;
 
-    SqueezeBoxServer::instance()->command({ playerId(), u"playerpref"_qs, u"alarmsEnabled"_qs,
-                                            QString::number(alarmsEnabled ? 1 : 0) });
+    m_server->command({ playerId(), u"playerpref"_qs, u"alarmsEnabled"_qs,
+                       QString::number(alarmsEnabled ? 1 : 0) });
     m_alarmsEnabled = alarmsEnabled;
     emit alarmsEnabledChanged(m_alarmsEnabled);
 }
 
+void SqueezeBoxPlayer::setVolume(int volume)
+{
+    volume = qBound(0, volume, 100);
+    if (volume == m_nowPlaying.m_volume)
+        return;
+
+    m_server->coalescedCommand(playerId(), u"volume"_qs, { u"mixer"_qs, u"volume"_qs, volume });
+    // the status update from the server will confirm this
+    m_nowPlaying.m_volume = volume;
+    emit volumeChanged(volume);
+}
+
+void SqueezeBoxPlayer::seek(qreal time)
+{
+    if (time < 0)
+        return;
+
+    m_server->coalescedCommand(playerId(), u"time"_qs, { u"time"_qs, time });
+    m_nowPlaying.m_time = time;
+    m_timeReceived.start();
+    emit timeChanged(this->time());
+}
+
 QList<QObject *> SqueezeBoxPlayer::alarms() const
 {
     QObjectList alarms;
@@ -681,26 +1756,26 @@ bool SqueezeBoxPlayer::newAlarm(bool enabled, bool repeat, int time, const QVari
     if (!dayOfWeek.isEmpty())
         args.append(u"dow:%1"_qs.arg(SqueezeBoxAlarm::dayOfWeekListToString(dayOfWeek)));
 
-    SqueezeBoxServer::instance()->command(args);
+    m_server->command(args);
     return true;
 }
 
 void SqueezeBoxPlayer::deleteAlarm(const QString &alarmId)
 {
     if (m_alarms.contains(alarmId))
-        SqueezeBoxServer::instance()->command({ playerId(), u"alarm"_qs, u"delete"_qs, u"id:%1"_qs.arg(alarmId) });
+        m_server->command({ playerId(), u"alarm"_qs, u"delete"_qs, u"id:%1"_qs.arg(alarmId) });
 }
 
 void SqueezeBoxPlayer::alarmSnooze()
 {
     if (m_alarmActive)
-        SqueezeBoxServer::instance()->command({ playerId(), u"button"_qs, u"snooze"_qs });
+        m_server->command({ playerId(), u"button"_qs, u"snooze"_qs });
 }
 
 void SqueezeBoxPlayer::alarmStop()
 {
     if (m_alarmActive)
-        SqueezeBoxServer::instance()->command({ playerId(), u"button"_qs, u"stop"_qs });
+        m_server->command({ playerId(), u"button"_qs, u"stop"_qs });
 }
 
 QDateTime SqueezeBoxPlayer::nextAlarm() const
@@ -718,6 +1793,178 @@ bool SqueezeBoxPlayer::snoozing() const
     return m_snoozing;
 }
 
+bool SqueezeBoxPlayer::stale() const
+{
+    return m_stale;
+}
+
+QString SqueezeBoxPlayer::mode() const
+{
+    return m_nowPlaying.m_mode;
+}
+
+qreal SqueezeBoxPlayer::time() const
+{
+    qreal t = m_nowPlaying.m_time;
+    if ((m_nowPlaying.m_mode == u"play") && m_timeReceived.isValid())
+        t += qreal(m_timeReceived.elapsed()) / 1000;
+    if (m_nowPlaying.m_duration > 0)
+        t = qMin(t, m_nowPlaying.m_duration);
+    return t;
+}
+
+qreal SqueezeBoxPlayer::duration() const
+{
+    return m_nowPlaying.m_duration;
+}
+
+QString SqueezeBoxPlayer::title() const
+{
+    return m_nowPlaying.m_track.m_title;
+}
+
+QString SqueezeBoxPlayer::artist() const
+{
+    return m_nowPlaying.m_track.m_artist;
+}
+
+QUrl SqueezeBoxPlayer::coverArt() const
+{
+    return m_nowPlaying.m_track.m_coverArt;
+}
+
+int SqueezeBoxPlayer::volume() const
+{
+    return m_nowPlaying.m_volume;
+}
+
+int SqueezeBoxPlayer::playlistIndex() const
+{
+    return m_nowPlaying.m_playlistIndex;
+}
+
+SqueezeBoxPlaylistModel *SqueezeBoxPlayer::playlist() const
+{
+    return m_playlist;
+}
+
+void SqueezeBoxPlayer::updateNowPlaying(NowPlaying np)
+{
+    // The server might still push values from before our own, optimistically applied changes:
+    // these are only reliable again after the last of our coalesced commands was answered
+    if (m_server->isCoalescing(playerId(), u"volume"_qs))
+        np.m_volume = m_nowPlaying.m_volume;
+    if (m_server->isCoalescing(playerId(), u"time"_qs))
+        np.m_time = time();
+
+    const NowPlaying old = std::exchange(m_nowPlaying, np);
+    m_timeReceived.start();
+
+    if (np.m_mode == u"play")
+        m_timeTicker.start();
+    else
+        m_timeTicker.stop();
+
+    if (np.m_mode != old.m_mode)
+        emit modeChanged(np.m_mode);
+    emit timeChanged(time()); // the base for the interpolation always changes
+    if (np.m_duration != old.m_duration)
+        emit durationChanged(np.m_duration);
+    if (np.m_track.m_title != old.m_track.m_title)
+        emit titleChanged(np.m_track.m_title);
+    if (np.m_track.m_artist != old.m_track.m_artist)
+        emit artistChanged(np.m_track.m_artist);
+    if (np.m_track.m_coverArt != old.m_track.m_coverArt)
+        emit coverArtChanged(np.m_track.m_coverArt);
+    if (np.m_volume != old.m_volume)
+        emit volumeChanged(np.m_volume);
+    if (np.m_playlistIndex != old.m_playlistIndex)
+        emit playlistIndexChanged(np.m_playlistIndex);
+}
+
+
+SqueezeBoxPlaylistModel::SqueezeBoxPlaylistModel(QObject *parent)
+    : QAbstractListModel(parent)
+{ }
+
+int SqueezeBoxPlaylistModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : int(m_tracks.size());
+}
+
+QVariant SqueezeBoxPlaylistModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || (index.row() >= m_tracks.size()))
+        return { };
+
+    const SqueezeBoxTrack &track = m_tracks.at(index.row());
+
+    switch (role) {
+    case Title: return track.m_title;
+    case Artist: return track.m_artist;
+    case Album: return track.m_album;
+    case Duration: return track.m_duration;
+    case CoverArt: return track.m_coverArt;
+    }
+    return { };
+}
+
+QHash<int, QByteArray> SqueezeBoxPlaylistModel::roleNames() const
+{
+    static QHash<int, QByteArray> roleNames = {
+        { Title, "title" },
+        { Artist, "artist" },
+        { Album, "album" },
+        { Duration, "duration" },
+        { CoverArt, "coverArt" }
+    };
+    return roleNames;
+}
+
+QVariantMap SqueezeBoxPlaylistModel::get(int row) const
+{
+    QVariantMap map;
+    if (row >= 0 && row < rowCount()) {
+        const auto roles = roleNames();
+        for (auto it = roles.begin(); it != roles.end(); ++it)
+            map.insert(QString::fromLatin1(it.value()), data(index(row), it.key()));
+    }
+    return map;
+}
+
+void SqueezeBoxPlaylistModel::update(const QVector<SqueezeBoxTrack> &tracks)
+{
+    // most changes are a single add, delete or move: find the common head and tail
+    const qsizetype oldSize = m_tracks.size();
+    const qsizetype newSize = tracks.size();
+
+    qsizetype head = 0;
+    while ((head < oldSize) && (head < newSize) && (m_tracks.at(head) == tracks.at(head)))
+        ++head;
+    qsizetype tail = 0;
+    while ((tail < (oldSize - head)) && (tail < (newSize - head))
+           && (m_tracks.at(oldSize - 1 - tail) == tracks.at(newSize - 1 - tail))) {
+        ++tail;
+    }
+
+    const qsizetype removed = oldSize - head - tail;
+    const qsizetype inserted = newSize - head - tail;
+
+    if (removed > 0) {
+        beginRemoveRows({ }, int(head), int(head + removed - 1));
+        m_tracks.remove(head, removed);
+        endRemoveRows();
+    }
+    if (inserted > 0) {
+        beginInsertRows({ }, int(head), int(head + inserted - 1));
+        m_tracks.insert(head, inserted, SqueezeBoxTrack { });
+        std::copy(tracks.cbegin() + head, tracks.cbegin() + head + inserted, m_tracks.begin() + head);
+        endInsertRows();
+    }
+    if (oldSize != newSize)
+        emit countChanged();
+}
+
 
 QString SqueezeBoxAlarm::playerId() const
 {
@@ -816,11 +2063,14 @@ void SqueezeBoxAlarm::setEnabled(bool enabled)
     if (m_enabled == enabled)
         return;
 
-    SqueezeBoxServer::instance()->command({ playerId(), u"alarm"_qs, u"update"_qs,
-                                           u"id:%1"_qs.arg(m_alarmId),
-                                           u"enabled:%1"_qs.arg(enabled ? 1 : 0) });
+    m_player->m_server->command({ playerId(), u"alarm"_qs, u"update"_qs,
+                                 u"id:%1"_qs.arg(m_alarmId),
+                                 u"enabled:%1"_qs.arg(enabled ? 1 : 0) });
     m_enabled = enabled;
     emit enabledChanged(m_enabled);
+
+    if (m_player)
+        m_player->scheduleAlarm(this);
 }
 
 void SqueezeBoxAlarm::setRepeat(bool repeat)
@@ -828,9 +2078,9 @@ void SqueezeBoxAlarm::setRepeat(bool repeat)
     if (m_repeat == repeat)
         return;
 
-    SqueezeBoxServer::instance()->command({ playerId(), u"alarm"_qs, u"update"_qs,
-                                           u"id:%1"_qs.arg(m_alarmId),
-                                           u"repeat:%1"_qs.arg(repeat ? 1 : 0) });
+    m_player->m_server->command({ playerId(), u"alarm"_qs, u"update"_qs,
+                                 u"id:%1"_qs.arg(m_alarmId),
+                                 u"repeat:%1"_qs.arg(repeat ? 1 : 0) });
     m_repeat = repeat;
     emit repeatChanged(m_repeat);
 }
@@ -840,11 +2090,14 @@ void SqueezeBoxAlarm::setTime(int time)
     if (m_time == time)
         return;
 
-    SqueezeBoxServer::instance()->command({ playerId(), u"alarm"_qs, u"update"_qs,
-                                           u"id:%1"_qs.arg(m_alarmId),
-                                           u"time:%1"_qs.arg(time) });
+    m_player->m_server->command({ playerId(), u"alarm"_qs, u"update"_qs,
+                                 u"id:%1"_qs.arg(m_alarmId),
+                                 u"time:%1"_qs.arg(time) });
     m_time = time;
     emit timeChanged(m_time);
+
+    if (m_player)
+        m_player->scheduleAlarm(this);
 }
 
 void SqueezeBoxAlarm::setDayOfWeek(const QVariantList &dayOfWeek)
@@ -852,11 +2105,14 @@ void SqueezeBoxAlarm::setDayOfWeek(const QVariantList &dayOfWeek)
     if (m_dayOfWeek == dayOfWeek)
         return;
 
-    SqueezeBoxServer::instance()->command({ playerId(), u"alarm"_qs, u"update"_qs,
-                                           u"id:%1"_qs.arg(m_alarmId),
-                                           u"dow:%1"_qs.arg(SqueezeBoxAlarm::dayOfWeekListToString(dayOfWeek)) });
+    m_player->m_server->command({ playerId(), u"alarm"_qs, u"update"_qs,
+                                 u"id:%1"_qs.arg(m_alarmId),
+                                 u"dow:%1"_qs.arg(SqueezeBoxAlarm::dayOfWeekListToString(dayOfWeek)) });
     m_dayOfWeek = dayOfWeek;
     emit dayOfWeekChanged();
+
+    if (m_player)
+        m_player->scheduleAlarm(this);
 }
 
 void SqueezeBoxAlarm::setVolume(qreal volume)
@@ -864,9 +2120,9 @@ void SqueezeBoxAlarm::setVolume(qreal volume)
     if (qFuzzyCompare(m_volume, volume))
         return;
 
-    SqueezeBoxServer::instance()->command({ playerId(), u"alarm"_qs, u"update"_qs,
-                                           u"id:%1"_qs.arg(m_alarmId),
-                                           u"volume:%1"_qs.arg(int(volume * 100)) });
+    m_player->m_server->command({ playerId(), u"alarm"_qs, u"update"_qs,
+                                 u"id:%1"_qs.arg(m_alarmId),
+                                 u"volume:%1"_qs.arg(int(volume * 100)) });
     m_volume = volume;
     emit volumeChanged(m_volume);
 }
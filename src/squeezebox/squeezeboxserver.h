@@ -11,16 +11,21 @@
 #include <QPointer>
 #include <QTcpSocket>
 #include <QQueue>
+#include <QSet>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QTimer>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QVarLengthArray>
 
 #include <functional>
 #include <optional>
 
-
-using StringMap = QMap<QString, QString>;
+QT_FORWARD_DECLARE_CLASS(QUdpSocket)
 
 class SqueezeBoxPlayer;
+class SqueezeBoxServer;
 
 class SqueezeBoxAlarm : public QObject
 {
@@ -76,11 +81,66 @@ private:
     QVariantList m_dayOfWeek;
     qreal m_volume;
     QUrl m_url;
+    quint64 m_generation = 0; // see SqueezeBoxPlayer::m_upcomingAlarms
 
     Q_DISABLE_COPY(SqueezeBoxAlarm)
     friend class SqueezeBoxServer;
 };
 
+struct SqueezeBoxTrack
+{
+    QString m_trackId;
+    QString m_title;
+    QString m_artist;
+    QString m_album;
+    qreal m_duration = 0; // sec
+    QUrl m_coverArt;
+
+    bool operator==(const SqueezeBoxTrack &other) const
+    {
+        return (m_trackId == other.m_trackId) && (m_title == other.m_title)
+                && (m_artist == other.m_artist) && (m_album == other.m_album)
+                && qFuzzyCompare(m_duration, other.m_duration) && (m_coverArt == other.m_coverArt);
+    }
+    bool operator!=(const SqueezeBoxTrack &other) const { return !(*this == other); }
+};
+
+class SqueezeBoxPlaylistModel : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(int count READ rowCount NOTIFY countChanged)
+
+public:
+    enum Roles {
+        Title = Qt::UserRole + 1,
+        Artist,
+        Album,
+        Duration,
+        CoverArt,
+    };
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    Q_INVOKABLE QVariantMap get(int row) const;
+
+signals:
+    void countChanged();
+
+private:
+    explicit SqueezeBoxPlaylistModel(QObject *parent);
+
+    // only the changed range is removed and re-inserted
+    void update(const QVector<SqueezeBoxTrack> &tracks);
+
+    QVector<SqueezeBoxTrack> m_tracks;
+
+    Q_DISABLE_COPY(SqueezeBoxPlaylistModel)
+    friend class SqueezeBoxPlayer;
+    friend class SqueezeBoxServer;
+};
+
 class SqueezeBoxPlayer : public QObject
 {
     Q_OBJECT
@@ -93,6 +153,18 @@ class SqueezeBoxPlayer : public QObject
     Q_PROPERTY(QDateTime nextAlarm READ nextAlarm NOTIFY nextAlarmChanged)
     Q_PROPERTY(bool alarmActive READ alarmActive NOTIFY alarmActiveChanged)
     Q_PROPERTY(bool snoozing READ snoozing NOTIFY snoozingChanged)
+    // not confirmed by the server yet: restored from the cache or kept while disconnected
+    Q_PROPERTY(bool stale READ stale NOTIFY staleChanged)
+
+    Q_PROPERTY(QString mode READ mode NOTIFY modeChanged)
+    Q_PROPERTY(qreal time READ time WRITE seek NOTIFY timeChanged)
+    Q_PROPERTY(qreal duration READ duration NOTIFY durationChanged)
+    Q_PROPERTY(QString title READ title NOTIFY titleChanged)
+    Q_PROPERTY(QString artist READ artist NOTIFY artistChanged)
+    Q_PROPERTY(QUrl coverArt READ coverArt NOTIFY coverArtChanged)
+    Q_PROPERTY(int volume READ volume WRITE setVolume NOTIFY volumeChanged)
+    Q_PROPERTY(int playlistIndex READ playlistIndex NOTIFY playlistIndexChanged)
+    Q_PROPERTY(SqueezeBoxPlaylistModel *playlist READ playlist CONSTANT)
 
 public:
     QString playerId() const;
@@ -102,6 +174,17 @@ public:
     QDateTime nextAlarm() const;
     bool alarmActive() const;
     bool snoozing() const;
+    bool stale() const;
+
+    QString mode() const;
+    qreal time() const;
+    qreal duration() const;
+    QString title() const;
+    QString artist() const;
+    QUrl coverArt() const;
+    int volume() const;
+    int playlistIndex() const;
+    SqueezeBoxPlaylistModel *playlist() const;
 
     Q_INVOKABLE bool newAlarm(bool enabled = false, bool repeat = true, int time = 8 * 60 * 60, const QVariantList &dayOfWeek = {});
     Q_INVOKABLE void deleteAlarm(const QString &alarmId);
@@ -111,6 +194,8 @@ public:
 
 public slots:
     void setAlarmsEnabled(bool alarmsEnabled);
+    void setVolume(int volume);
+    void seek(qreal time);
 
 signals:
     void nameChanged(const QString &name);
@@ -119,32 +204,83 @@ signals:
     void nextAlarmChanged(const QDateTime &nextAlarm);
     void alarmActiveChanged(bool alarmActive);
     void snoozingChanged(bool snoozing);
+    void staleChanged(bool stale);
+
+    void modeChanged(const QString &mode);
+    void timeChanged(qreal time);
+    void durationChanged(qreal duration);
+    void titleChanged(const QString &title);
+    void artistChanged(const QString &artist);
+    void coverArtChanged(const QUrl &coverArt);
+    void volumeChanged(int volume);
+    void playlistIndexChanged(int playlistIndex);
 
     void alarmAdded(SqueezeBoxAlarm *alarm);
     void alarmRemoved(SqueezeBoxAlarm *alarm);
     void alarmSounding(bool sounding);
 
 private:
-    SqueezeBoxPlayer();
+    explicit SqueezeBoxPlayer(SqueezeBoxServer *server);
 
     void updateName(const QString &s);
     void updateAlarmsEnabled(const QString &s);
     void updateAlarmActive(bool on);
     void updateSnoozing(bool on);
+    void updateStale(bool stale);
+
+    // nextAlarm is the top of a min-heap of every enabled alarm's next occurrence: a single
+    // changed alarm is rescheduled in O(log n), the stale entry is dropped lazily
+    void updateNextAlarm(); // rebuilds the heap
+    void scheduleAlarm(SqueezeBoxAlarm *alarm);
+    void removeAlarm(const QString &alarmId);
+    void refreshNextAlarm();
+    static QDateTime nextOccurrence(const SqueezeBoxAlarm *alarm, const QDateTime &after);
+
+    // the result of a "status" query, as pushed by the server on every change
+    struct NowPlaying
+    {
+        QString m_mode;
+        qreal m_time = 0;
+        qreal m_duration = 0;
+        int m_volume = 0;
+        int m_playlistIndex = -1;
+        QByteArray m_playlistTimestamp;
+        SqueezeBoxTrack m_track;
+    };
+    void updateNowPlaying(NowPlaying np);
 
-    void updateNextAlarm();
-
+    SqueezeBoxServer *m_server; // owns this player
     QString m_playerId;
     QString m_name;
     bool m_alarmsEnabled = false;
     QMap<QString, SqueezeBoxAlarm *> m_alarms;
     QDateTime m_nextAlarm;
+
+    struct UpcomingAlarm
+    {
+        qint64 m_time; // msecs since epoch
+        QString m_alarmId;
+        quint64 m_generation; // stale, if it doesn't match the alarm's
+
+        bool operator>(const UpcomingAlarm &other) const { return m_time > other.m_time; }
+    };
+    QVector<UpcomingAlarm> m_upcomingAlarms;
+    QTimer m_nextAlarmTimer;
+    static quint64 s_alarmGeneration;
     bool m_alarmActive = false;
     bool m_snoozing = false;
+    bool m_stale = false;
     QString m_address;
 
+    NowPlaying m_nowPlaying;
+    // the elapsed time is interpolated locally between status updates
+    QElapsedTimer m_timeReceived;
+    QTimer m_timeTicker;
+    SqueezeBoxPlaylistModel *m_playlist;
+
     Q_DISABLE_COPY(SqueezeBoxPlayer)
     friend class SqueezeBoxServer;
+    friend class SqueezeBoxAlarm;
 };
 
 class SqueezeBoxServer : public QObject
@@ -155,18 +291,43 @@ class SqueezeBoxServer : public QObject
     Q_PROPERTY(bool connected READ connected NOTIFY connectedChanged)
 
 public:
+    enum class Transport {
+        Cli,     // the telnet-like CLI on port 9090
+        JsonRpc, // JSON requests and Comet subscriptions over HTTP on port 9000
+    };
+
     static SqueezeBoxServer *instance();
     static SqueezeBoxServer *createInstance(const QString &serverHost, int serverPort = 9090, QObject *parent = nullptr);
 
+    // An independent instance, which is not returned by instance(): for tests and benchmarks,
+    // which need a fresh client for every run
+    static SqueezeBoxServer *create(const QString &serverHost, int serverPort = 9090, QObject *parent = nullptr);
+
+    // closes the connection for good, without any reconnects: e.g. before deleting this instance
+    void disconnectFromServer();
+
+    // the last server and its players, so the UI can be populated before we are connected
+    static QString cacheFileName();
+
+    void setTransport(Transport transport);
+
+    // find the server via the LMS UDP discovery protocol, if no host is configured or the
+    // configured (or last discovered) one cannot be reached anymore
+    void setDiscoveryEnabled(bool enabled);
+
     void setPlayerNameFilter(const QStringList &nameFilter);
 
     void setThisPlayerName(const QString &thisPlayerName);
 
     void setThisPlayerAlarmState(const QString &newState); // Android only
 
+    // maximum number of commands in flight on the CLI connection (1 means: stop-and-wait)
+    void setCommandWindowSize(int windowSize);
+
     void command(const QVariantList &args, const std::function<void (const QStringList &)> &callback);
 
-    static QPair<StringMap, QVector<StringMap>> parseExtendedResult(const QStringList &result, const QString &separatorTag);
+    // server-side scaled artwork, used by SqueezeBoxCoverArtProvider
+    QUrl coverArtUrl(const QString &coverId, const QSize &size) const;
 
     QList<SqueezeBoxPlayer *> players() const;
     SqueezeBoxPlayer *thisPlayer();
@@ -189,44 +350,167 @@ protected:
     void parseCommandData();
 
 private:
-    void onPlayersReply(const QStringList &result);
+    // the raw, still percent-encoded tokens of a CLI line, pointing into the receive buffer
+    using RawArgs = QVarLengthArray<QByteArrayView, 32>;
+    using RawCallback = std::function<void(const RawArgs &)>;
+
+    static void tokenize(QByteArrayView line, RawArgs &args);
+    QByteArrayView decodeRawArg(QByteArrayView rawArg);
+    QString decodeArg(QByteArrayView rawArg);
+    QStringList decodeArgs(const RawArgs &args, qsizetype from = 0);
+    void handleNotification(const RawArgs &args);
+
+    // typed results of the "players" and "alarms" queries
+    struct PlayerInfo
+    {
+        QString m_id;
+        QString m_ip; // without the port
+        QString m_name;
+    };
+    struct AlarmInfo
+    {
+        QString m_id;
+        bool m_enabled = false;
+        bool m_repeat = false;
+        int m_time = 0;
+        QVariantList m_dayOfWeek;
+        qreal m_volume = 0; // 0..1
+        QUrl m_url;
+    };
+
+    static bool splitTaggedArg(QByteArrayView rawArg, QByteArrayView &tag, QByteArrayView &rawValue);
+    bool decodePlayersReply(const RawArgs &args, QVector<PlayerInfo> &players);
+    bool decodeAlarmsReply(const RawArgs &args, QVector<AlarmInfo> &alarms);
+
+    enum AlarmField : uint {
+        AlarmIdField        = 0x01,
+        AlarmEnabledField   = 0x02,
+        AlarmRepeatField    = 0x04,
+        AlarmTimeField      = 0x08,
+        AlarmDayOfWeekField = 0x10,
+        AlarmVolumeField    = 0x20,
+        AlarmUrlField       = 0x40,
+        AllAlarmFields      = 0x7f,
+    };
+    uint decodeAlarmTag(QByteArrayView tag, QByteArrayView value, AlarmInfo &alarm); // returns the AlarmField
+    static void applyAlarmInfo(SqueezeBoxAlarm *alarm, const AlarmInfo &info, uint fields);
+    void onAlarmNotification(SqueezeBoxPlayer *player, const RawArgs &args);
+
+    bool decodeStatusReply(const RawArgs &args, SqueezeBoxPlayer::NowPlaying &nowPlaying,
+                           QVector<SqueezeBoxTrack> &tracks);
+    static void encodeArgs(const QStringList &args, QByteArrayList &storage, RawArgs &rawArgs);
+    QUrl httpUrl(const QString &pathOrUrl) const;
+
+    void onPlayersReply(const RawArgs &result);
+    SqueezeBoxPlayer *addPlayer(const QString &id, const QString &name, const QString &ip);
+    bool isThisPlayer(const QString &name, const QString &ip) const;
+    void setupPlayer(SqueezeBoxPlayer *player);
     void onPlayerPrefAlarmsEnabledReply(const QString &playerId, const QStringList &result);
-    void onPlayerAlarmsReply(const QString &playerId, const QStringList &result);
+    void onPlayerAlarmsReply(const QString &playerId, const RawArgs &result);
+    void onPlayerStatusReply(const QString &playerId, const RawArgs &result);
+    void onPlayerPlaylistReply(const QString &playerId, const RawArgs &result);
 
     explicit SqueezeBoxServer(const QString &serverHost, int serverPort = 9090, QObject *parent = nullptr);
 
-    void send(const QStringList &args, const std::function<void(const QStringList &)> &callback);
+    // like command(), but the reply is passed on undecoded
+    void rawCommand(const QVariantList &args, const RawCallback &callback);
+
+    void send(const QStringList &args, const std::function<void(const QStringList &)> &callback,
+              const RawCallback &rawCallback = {}, const QString &coalesceKey = {});
+    void sendPending();
+    static QByteArray encodeCommand(const QStringList &args);
+
+    // For commands driven by sliders (volume, seek): only the newest value per player and kind is
+    // kept and there is at most one of each in flight, so a burst of slider moves results in
+    // one command per round-trip instead of a backlog of stale values.
+    void coalescedCommand(const QString &playerId, const QString &kind, const QVariantList &args);
+    static QString coalesceKey(const QString &playerId, const QString &kind);
+    bool isCoalescing(const QString &playerId, const QString &kind) const; // queued or in flight
+    void finishCoalesced(const QString &key);
+
+    void cometHandshake();
+    void cometConnect();
+    void cometPost(const QJsonArray &messages, const std::function<void(const QJsonArray &)> &onReply);
+    void cometDispatch(const QJsonArray &messages);
+    void cometSubscribePlayer(const QString &playerId);
+    void cometDisconnected();
+    void onPlayerStatus(const QString &playerId, const QJsonObject &status);
+    static QStringList flattenJsonResult(const QJsonObject &result);
+
+    void discover();
+    void onDiscoveryReply();
+
+    void loadCache();
+    void saveCache() const;
+
     static SqueezeBoxServer *s_instance;
 
     struct Command {
         quint64    id { 0 };
         QByteArray raw;
+        QString    playerId; // empty for server commands
         std::function<void(const QStringList &)> callback;
+        RawCallback rawCallback; // used instead of callback, if set
+        QString coalesceKey; // see coalescedCommand()
     };
 
     QString m_serverHost;
     quint16 m_serverPort;
+    quint16 m_httpPort = 9000; // for cover art
+    Transport m_transport = Transport::Cli;
     QTcpSocket m_listen;
     QTcpSocket m_command;
     QTimer m_reconnectTimer;
     int m_timeoutReconnect = 4 * 1000;
     bool m_disabled = false;
+    bool m_disconnectRequested = false; // see disconnectFromServer()
     bool m_connected = false;
+    int m_failedConnects = 0; // since the last successful connect
+    bool m_cacheLoaded = false;
+
+    bool m_discoveryEnabled = false;
+    QUdpSocket *m_discovery = nullptr;
+
+    // Accumulates the data received on a CLI socket. Lines are consumed by advancing a read
+    // cursor, the consumed bytes are only dropped once there is no complete line left, so bursts
+    // do not cause a memmove per line and the buffer's capacity is reused.
+    struct LineBuffer
+    {
+        QByteArray m_data;
+        qsizetype m_pos = 0;
+
+        void read(QIODevice *device);
+        std::optional<QByteArrayView> nextLine();
+        void clear() { m_data.resize(0); m_pos = 0; }
+    };
+    LineBuffer m_listenBuffer;
+    LineBuffer m_commandBuffer;
+    QByteArray m_decodeArena; // reused by decodeRawArg()
 
-    QByteArray m_listenData;
-    QByteArray m_commandData;
-
-    std::optional<Command> m_sent;
+    // The LMS CLI answers strictly in order, so we can pipeline commands and match the replies
+    // to the oldest command in flight.
+    QQueue<Command> m_inFlight;
     QQueue<Command> m_outgoing;
+    int m_windowSize = 8;
+    QHash<QString, QStringList> m_coalesced; // in flight: key -> next args (empty if none)
+
+    // JSON-RPC / Comet transport
+    QNetworkAccessManager *m_nam = nullptr;
+    QString m_cometClientId;
+    QHash<quint64, Command> m_cometRequests; // in flight, by id
+    QHash<QString, QString> m_nextAlarms; // player id -> alarm_next of the last status
 
     QMap<QString, SqueezeBoxPlayer *> m_players;
+    QStringList m_serverPlayerIds; // sorted, including the ones not matching m_nameFilter
+    QSet<QByteArray> m_rawPlayerIds; // percent-encoded, as they appear on the CLI
     QPointer<SqueezeBoxPlayer> m_thisPlayer;
 
-    QStringList m_ipAddresses;
+    QSet<QString> m_ipAddresses;
     QStringList m_nameFilter;
     QString m_thisPlayerName;
 
     Q_DISABLE_COPY(SqueezeBoxServer)
+    friend class SqueezeBoxPlayer;
     friend class SqueezeBoxPlayerModel;
     friend class SqueezeBoxAlarmModel;
 };